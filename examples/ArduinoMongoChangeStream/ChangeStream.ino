@@ -0,0 +1,53 @@
+// ######################################
+// ----- ARDUINO MONGO CHANGE STREAM ----
+// ######################################
+// Incremental sync using the change log. Serial stands in for the remote MongoDB:
+// every change since the last acknowledged one is "uploaded", then truncated.
+
+#include "arduino_mongodb.h"
+
+// Sequence number of the last change acknowledged by the remote. It's kept in a file
+// so that changes that weren't acknowledged before a reset are uploaded again.
+#define SYNC_CURSOR "/sync_cursor"
+uint32_t synced = 0;
+
+// Uploads pending changes, a few at a time, and discards them once acknowledged
+void sync()
+{
+    uint32_t last = ArduinoMongoDB::readChanges(synced, [](const String &change)
+                                                { Serial.println("upload: " + change); },
+                                                8);
+    if (last == synced)
+        return;
+
+    // The stand-in consumer acknowledges everything it receives. Save the cursor
+    // before truncating, so that a reset in between can't skip changes.
+    if (!little_fs.writeFile(SYNC_CURSOR, String(last)))
+        return;
+    synced = last;
+    ArduinoMongoDB::truncateChanges(synced);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+
+    ArduinoMongoDB::connect("mongodb://SyncExample");
+    ArduinoMongoDB::enableChangeLog();
+    ArduinoMongoDB::createCollection("events");
+
+    // Resume after the last acknowledged change
+    if (little_fs.exists(SYNC_CURSOR))
+        synced = little_fs.readFile(SYNC_CURSOR).toInt();
+
+    ArduinoMongoDB::createDocument("{\"_id\":\"1\",\"type\":\"boot\"}", "events", "1");
+    ArduinoMongoDB::createDocument("{\"_id\":\"2\",\"type\":\"reading\",\"value\":21.5}", "events", "2");
+    ArduinoMongoDB::updateDocument("{\"_id\":\"2\",\"type\":\"reading\",\"value\":22.0}", "events", "2");
+    ArduinoMongoDB::deleteDocument("events", "1");
+}
+
+void loop()
+{
+    sync();
+    delay(1000);
+}
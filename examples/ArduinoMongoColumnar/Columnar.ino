@@ -0,0 +1,44 @@
+// ######################################
+// ------ ARDUINO MONGO COLUMNAR --------
+// ######################################
+// Sensor readings stored as typed columns: aggregating one field
+// reads only that field's column, not the whole documents.
+
+#include "arduino_mongo_model.h"
+
+using SF = ArduinoMongoSchemaField;
+auto readingSchema = ArduinoMongoSchema({{"time", SF(DBType::Int, true, "", 0, INFINITY, nullptr)},
+                                         {"temperature", SF(DBType::Float, true, "", -40, 125, nullptr)},
+                                         {"humidity", SF(DBType::Float, false, "", 0, 100, nullptr)},
+                                         {"alarm", SF(DBType::Boolean, false, "", 0, 0, nullptr)}})
+                         .setColumnar();
+
+void setup()
+{
+    Serial.begin(115200);
+    ArduinoMongoDB::connect("mongodb://ColumnarExample");
+
+    ArduinoMongoModel reading("readings", readingSchema);
+    for (int i = 0; i < 100; i++)
+    {
+        reading.setDocument("{\"time\":" + String(i) + ",\"temperature\":" + String(20 + (i % 10) * 0.5) + "}");
+        reading.save();
+    }
+
+    ArduinoMongoColumnStats stats;
+    if (ArduinoMongoDB::aggregateColumn("readings", "temperature", stats))
+    {
+        Serial.println("count: " + String(stats.count) + ", mean: " + String(stats.sum / stats.count) +
+                       ", min: " + String(stats.min) + ", max: " + String(stats.max));
+    }
+
+    // Scan a single column
+    ArduinoMongoDB::scanColumn("readings", "temperature", [](uint32_t ID, double value)
+                               {
+        if (value > 24)
+            Serial.println("reading " + String(ID) + " is warm"); });
+}
+
+void loop()
+{
+}
@@ -0,0 +1,71 @@
+// ######################################
+// ------ ARDUINO MONGO COMPRESSION -----
+// ######################################
+// Compares compressed and uncompressed document storage:
+// compression ratio, and the cost of writing and reading documents.
+
+#include "arduino_mongodb.h"
+#include "schema.h"
+
+#define DOCUMENT_COUNT 50
+
+// Writes and reads back DOCUMENT_COUNT documents, printing the time taken for each
+void benchmark(const String &collection, const String &doc)
+{
+    unsigned long start = micros();
+    for (int i = 0; i < DOCUMENT_COUNT; i++)
+        ArduinoMongoDB::createDocument(doc, collection, String(i));
+    unsigned long writeTime = micros() - start;
+
+    start = micros();
+    for (int i = 0; i < DOCUMENT_COUNT; i++)
+        ArduinoMongoDB::readDocument(collection, String(i));
+    unsigned long readTime = micros() - start;
+
+    Serial.println(collection + ": write " + String(writeTime / DOCUMENT_COUNT) + "us/doc, read " +
+                   String(readTime / DOCUMENT_COUNT) + "us/doc");
+}
+
+void setup()
+{
+    Serial.begin(115200);
+
+    using SF = ArduinoMongoSchemaField;
+    auto userSchema = ArduinoMongoSchema({{"name", SF(DBType::Str, true, "", 0, 0, nullptr)},
+                                          {"age", SF(DBType::Int, true, "", 0, 200, nullptr)},
+                                          {"height", SF(DBType::Float, true, "", 0, 10, nullptr)},
+                                          {"weight", SF(DBType::Double, true, "", 0, 200, nullptr)},
+                                          {"is_admin", SF(DBType::Boolean, true, "", 0, 0, nullptr)}})
+                          .setCompression();
+
+    String doc = "{\"_id\":\"17\",\"name\":\"John\",\"age\":30,\"height\":1.75,\"weight\":75.0,\"is_admin\":true}";
+
+    // Compression ratio of a single document
+    ArduinoMongoCollectionOptions options;
+    options.compressed = true;
+    options.dictionary.push_back("_id");
+    for (const String &name : userSchema.fieldNames())
+        options.dictionary.push_back(name);
+
+    ArduinoMongoCodec codec(options.dictionary);
+    String encoded = codec.encode(doc);
+    Serial.println("Document: " + String(doc.length()) + " bytes, compressed: " + String(encoded.length()) +
+                   " bytes (" + String(100.0 * encoded.length() / doc.length()) + "%)");
+
+    unsigned long start = micros();
+    for (int i = 0; i < DOCUMENT_COUNT; i++)
+        codec.decode(codec.encode(doc));
+    Serial.println("Encode + decode: " + String((micros() - start) / DOCUMENT_COUNT) + "us/doc");
+
+    // Storage cost with and without compression
+    ArduinoMongoDB::connect("mongodb://CompressionBenchmark");
+    ArduinoMongoDB::createCollection("plain");
+    ArduinoMongoDB::createCollection("compressed", options);
+
+    benchmark("plain", doc);
+    benchmark("compressed", doc);
+}
+
+void loop()
+{
+}
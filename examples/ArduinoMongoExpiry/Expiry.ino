@@ -0,0 +1,35 @@
+// ######################################
+// ------- ARDUINO MONGO EXPIRY ---------
+// ######################################
+// A log collection that only keeps the last hour of events.
+// Expired events are deleted a few at a time from loop().
+
+#include "arduino_mongo_model.h"
+
+using SF = ArduinoMongoSchemaField;
+auto eventSchema = ArduinoMongoSchema({{"time", SF(DBType::Int, true, "", 0, INFINITY, nullptr)},
+                                       {"message", SF(DBType::Str, true, "", 0, 0, nullptr)}})
+                       .setExpiry("time", 3600);
+
+void setup()
+{
+    Serial.begin(115200);
+    ArduinoMongoDB::connect("mongodb://ExpiryExample");
+}
+
+void loop()
+{
+    // Seconds since boot stand in for a real clock
+    uint32_t now = millis() / 1000;
+
+    ArduinoMongoModel event("events", eventSchema);
+    event.setDocument("{\"time\":" + String(now) + ",\"message\":\"heartbeat\"}");
+    event.save();
+
+    // Delete up to 8 expired events, without opening any document
+    size_t expired = event.expire(now, 8);
+    if (expired > 0)
+        Serial.println("Expired " + String(expired) + " events");
+
+    delay(10000);
+}
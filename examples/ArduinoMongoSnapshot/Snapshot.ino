@@ -0,0 +1,39 @@
+// ######################################
+// ------ ARDUINO MONGO SNAPSHOT --------
+// ######################################
+// Backs up a database to a single snapshot file, then provisions
+// another database from it.
+
+#include <LittleFS.h>
+#include "arduino_mongodb.h"
+
+void setup()
+{
+    Serial.begin(115200);
+
+    ArduinoMongoDB::connect("mongodb://Factory");
+    ArduinoMongoDB::createCollection("settings");
+    ArduinoMongoDB::createDocument("{\"_id\":\"1\",\"interval\":60,\"unit\":\"C\"}", "settings", "1");
+
+    // Export: one sequential file instead of one file per document
+    File backup = LittleFS.open("/factory.snapshot", "w");
+    bool exported = ArduinoMongoDB::exportSnapshot(backup);
+    backup.close();
+    Serial.println(exported ? "Snapshot exported" : "Snapshot export failed");
+
+    // Import into another database, e.g. on first boot
+    ArduinoMongoDB::connect("mongodb://Device");
+    backup = LittleFS.open("/factory.snapshot", "r");
+    bool imported = ArduinoMongoDB::importSnapshot(backup);
+    backup.close();
+
+    if (imported)
+        Serial.println("Imported " + String(ArduinoMongoDB::countDocuments("settings")) + " settings: " +
+                       ArduinoMongoDB::readDocument("settings", "1"));
+    else
+        Serial.println("Snapshot import failed");
+}
+
+void loop()
+{
+}
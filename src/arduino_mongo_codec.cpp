@@ -0,0 +1,135 @@
+#include "arduino_mongo_codec.h"
+
+
+// ######################################
+// --------- DOCUMENT CODEC -------------
+// ######################################
+
+ArduinoMongoCodec::ArduinoMongoCodec(const std::vector<String> &keys)
+{
+    // Keys are matched with their quotes so that only whole keys are replaced
+    for (size_t i = 0; i < keys.size() && i < MAX_KEYS; i++)
+        _keys.push_back("\"" + keys[i] + "\"");
+}
+
+String ArduinoMongoCodec::encode(const String &doc) const
+{
+    // Control bytes are used as codes: documents containing them (e.g. pretty printed JSON)
+    // are stored as is
+    if (doc.length() == 0)
+        return doc;
+    for (size_t i = 0; i < doc.length(); i++)
+    {
+        if ((uint8_t)doc[i] < 0x20)
+            return doc;
+    }
+
+    // Replace dictionary keys with their code
+    String tokens;
+    tokens.reserve(doc.length());
+    for (size_t i = 0; i < doc.length();)
+    {
+        bool replaced = false;
+        if (doc[i] == '"')
+        {
+            for (size_t k = 0; k < _keys.size(); k++)
+            {
+                const String &key = _keys[k];
+                if (doc.length() - i >= key.length() && strncmp(doc.c_str() + i, key.c_str(), key.length()) == 0)
+                {
+                    tokens += (char)(k + 1);
+                    i += key.length();
+                    replaced = true;
+                    break;
+                }
+            }
+        }
+        if (!replaced)
+            tokens += doc[i++];
+    }
+
+    // Replace repeated runs with the longest back-reference in the window (greedy LZ77)
+    String res;
+    res.reserve(tokens.length() + 1);
+    res += MAGIC;
+
+    const char *src = tokens.c_str();
+    const size_t n = tokens.length();
+    for (size_t i = 0; i < n;)
+    {
+        size_t bestLen = 0, bestDist = 0;
+        for (size_t j = i > WINDOW ? i - WINDOW : 0; j < i; j++)
+        {
+            size_t len = 0;
+            while (len < MAX_MATCH && i + len < n && src[j + len] == src[i + len])
+                len++;
+            if (len > bestLen)
+            {
+                bestLen = len;
+                bestDist = i - j;
+            }
+        }
+
+        if (bestLen >= MIN_MATCH)
+        {
+            res += MATCH;
+            res += (char)bestDist;
+            res += (char)(bestLen - MIN_MATCH + 1);
+            i += bestLen;
+        }
+        else
+            res += src[i++];
+    }
+
+    // Don't pay for decoding if nothing was saved
+    return res.length() < doc.length() ? res : doc;
+}
+
+String ArduinoMongoCodec::decode(const String &doc) const
+{
+    if (!isEncoded(doc))
+        return doc;
+
+    // Resolve back-references
+    String tokens;
+    tokens.reserve(doc.length() * 2);
+    for (size_t i = 1; i < doc.length(); i++)
+    {
+        if (doc[i] != MATCH)
+        {
+            tokens += doc[i];
+            continue;
+        }
+
+        if (i + 2 >= doc.length())
+            return String();
+        const size_t dist = (uint8_t)doc[i + 1];
+        const size_t len = (uint8_t)doc[i + 2] + MIN_MATCH - 1;
+        i += 2;
+        if (dist == 0 || dist > tokens.length())
+            return String();
+
+        // Byte by byte: a match may overlap the bytes it produces
+        const size_t from = tokens.length() - dist;
+        for (size_t k = 0; k < len; k++)
+            tokens += tokens[from + k];
+    }
+
+    // Expand dictionary codes
+    String res;
+    res.reserve(tokens.length() * 2);
+    for (size_t i = 0; i < tokens.length(); i++)
+    {
+        const uint8_t code = tokens[i];
+        if (code >= 1 && code <= MAX_KEYS)
+        {
+            if (code > _keys.size())
+                return String();
+            res += _keys[code - 1];
+        }
+        else
+            res += (char)code;
+    }
+
+    return res;
+}
@@ -0,0 +1,49 @@
+#ifndef ARDUINO_MONGO_CODEC_HEADER
+#define ARDUINO_MONGO_CODEC_HEADER
+
+#include <Arduino.h>
+#include <vector>
+
+
+// ######################################
+// --------- DOCUMENT CODEC -------------
+// ######################################
+
+/* Lightweight compression for stored documents:
+ * - Quoted keys from a shared dictionary (the collection's schema field names) are
+ *   replaced by a single byte
+ * - Repeated byte runs are replaced by LZ77 back-references into a 255 byte window
+ *
+ * Encoded documents start with `MAGIC`. Every code is a control byte that can't
+ * appear unescaped in compact JSON, so encoded documents never contain a NUL and
+ * documents that aren't encoded are returned unchanged by `decode`.
+ * The dictionary is positional: ArduinoMongoDB keeps the keys of a collection holding
+ * documents in place and only appends new ones.
+ * */
+class ArduinoMongoCodec
+{
+public:
+    static const char MAGIC = 0x1F;     // first byte of an encoded document
+    static const char MATCH = 0x1E;     // back-reference: MATCH, distance, length - MIN_MATCH + 1
+    static const size_t MAX_KEYS = 29;  // dictionary codes are 0x01 ... 0x1D
+    static const size_t MIN_MATCH = 3;
+    static const size_t MAX_MATCH = MIN_MATCH + 254;
+    static const size_t WINDOW = 255;
+
+    ArduinoMongoCodec() {}
+    ArduinoMongoCodec(const std::vector<String> &keys);
+
+    // Returns the encoded document, or `doc` itself if it can't be encoded
+    String encode(const String &doc) const;
+
+    // Returns the decoded document, or an empty string if `doc` is corrupt
+    String decode(const String &doc) const;
+
+    // Returns true if `doc` was produced by `encode`
+    static bool isEncoded(const String &doc) { return doc.length() > 0 && doc[0] == MAGIC; }
+
+private:
+    std::vector<String> _keys; // quoted keys, indexed by code - 1
+};
+
+#endif // ARDUINO_MONGO_CODEC_HEADER
@@ -0,0 +1,57 @@
+#include "arduino_mongo_fs.h"
+#include ARDUINO_MONGODB_FS_HEADER
+
+
+// ######################################
+// ------------- FILE ACCESS ------------
+// ######################################
+
+bool ArduinoMongoFS::size(const String &path, size_t &size)
+{
+    File file = ARDUINO_MONGODB_FS.open(path, "r");
+    if (!file)
+        return false;
+    size = file.size();
+    file.close();
+    return true;
+}
+
+bool ArduinoMongoFS::readAt(const String &path, size_t offset, uint8_t *data, size_t len)
+{
+    File file = ARDUINO_MONGODB_FS.open(path, "r");
+    if (!file)
+        return false;
+    bool success = file.seek(offset) && file.read(data, len) == len;
+    file.close();
+    return success;
+}
+
+bool ArduinoMongoFS::writeAt(const String &path, size_t offset, const uint8_t *data, size_t len)
+{
+    File file = ARDUINO_MONGODB_FS.exists(path) ? ARDUINO_MONGODB_FS.open(path, "r+") : ARDUINO_MONGODB_FS.open(path, "w+");
+    if (!file)
+        return false;
+
+    size_t size = file.size();
+    bool success = file.seek(offset < size ? offset : size);
+    static const uint8_t zeros[16] = {0};
+    while (success && size < offset)
+    {
+        size_t n = offset - size < sizeof(zeros) ? offset - size : sizeof(zeros);
+        success = file.write(zeros, n) == n;
+        size += n;
+    }
+    success = success && file.write(data, len) == len;
+    file.close();
+    return success;
+}
+
+File ArduinoMongoFS::open(const String &path, const char *mode)
+{
+    return ARDUINO_MONGODB_FS.open(path, mode);
+}
+
+bool ArduinoMongoFS::rename(const String &from, const String &to)
+{
+    return ARDUINO_MONGODB_FS.rename(from, to);
+}
@@ -0,0 +1,43 @@
+#ifndef ARDUINO_MONGO_FS_HEADER
+#define ARDUINO_MONGO_FS_HEADER
+
+#include <Arduino.h>
+#include <FS.h>
+
+// File system the databases are stored on, the one the `little_fs` wrapper uses.
+// Both can be overridden together, e.g. to store the databases on an SD card.
+#ifndef ARDUINO_MONGODB_FS
+#define ARDUINO_MONGODB_FS LittleFS
+#define ARDUINO_MONGODB_FS_HEADER <LittleFS.h>
+#endif
+
+
+// ######################################
+// ------------- FILE ACCESS ------------
+// ######################################
+
+/* File access the `little_fs` wrapper doesn't provide: it reads and writes whole files as
+ * Strings, while file sizes, positioned access and streaming don't need a file in memory.
+ * Every access to ARDUINO_MONGODB_FS outside the wrapper goes through this class.
+ * */
+class ArduinoMongoFS
+{
+public:
+    // Returns true if file `path` exists, and its size in `size`
+    static bool size(const String &path, size_t &size);
+
+    // Reads exactly `len` bytes at `offset` of file `path`
+    static bool readAt(const String &path, size_t offset, uint8_t *data, size_t len);
+
+    // Writes `len` bytes at `offset` of file `path`, creating the file and zero filling any
+    // gap after its end
+    static bool writeAt(const String &path, size_t offset, const uint8_t *data, size_t len);
+
+    // Renames file or directory `from` to `to`, which must not exist
+    static bool rename(const String &from, const String &to);
+
+    // Opens file `path` to stream it, `mode` is "r" or "w". The file is invalid on failure.
+    static File open(const String &path, const char *mode);
+};
+
+#endif // ARDUINO_MONGO_FS_HEADER
@@ -5,7 +5,7 @@
 
 ArduinoMongoModel::ArduinoMongoModel(const String &collection, const ArduinoMongoSchema &schema,
                                      bool (*verify)(const ArduinoMongoModel &),
-                                     const String &document = String())
+                                     const String &document)
     : _collection{collection}, _schema{schema}, _document{document}, _verify{verify}
 {
     // Initialize the collection if it doesn't exist
@@ -15,13 +15,56 @@ ArduinoMongoModel::ArduinoMongoModel(const String &collection, const ArduinoMong
         return;
     }
 
-    if (!ArduinoMongoDB::createCollection(_collection))
+    // Compressed collections encode `_id` and the schema's field names as dictionary keys
+    ArduinoMongoCollectionOptions options;
+    options.compressed = _schema.compression();
+    if (options.compressed)
+    {
+        options.dictionary.push_back("_id");
+        for (const String &name : _schema.fieldNames())
+            options.dictionary.push_back(name);
+    }
+    options.expireAfter = _schema.expireAfter();
+    if (options.expireAfter > 0)
+        options.expiryField = _schema.expiryField();
+    if (_schema.columnar())
+    {
+        for (const String &name : _schema.fieldNames())
+            options.columns.push_back({name, _schema.fieldType(name)});
+    }
+
+    if (!ArduinoMongoDB::createCollection(_collection, options))
     {
         logerr("Failed to initialize collection: failed to create collection");
         return;
     }
 }
 
+String ArduinoMongoModel::nextID() const
+{
+    return ArduinoMongoDB::nextID(_collection);
+}
+
+String ArduinoMongoModel::valueOf(const String &document, const String &key)
+{
+    String value;
+    deserializeJSON(document, [&](JsonObject &json)
+                    {
+        if (json.containsKey(key))
+            value = json[key].as<String>(); });
+    return value;
+}
+
+String ArduinoMongoModel::get(const String &key) const
+{
+    return valueOf(_document, key);
+}
+
+String ArduinoMongoModel::operator[](const String &key) const
+{
+    return get(key);
+}
+
 void ArduinoMongoModel::setDocument(const String &docString)
 {
     _document = docString;
@@ -61,31 +104,272 @@ bool ArduinoMongoModel::save()
     // save document with the ArduinoMongoDB interface
     // get the document _id from the document or create one if it doesn't exist
     String _id = get("_id");
-    if (_id.length() == 0)
+    bool inserting = _id.length() == 0;
+    if (inserting)
     {
         _id = nextID();
+        if (_id.length() == 0)
+        {
+            logerr("Failed to save document: failed to create _id");
+            return false;
+        }
         set("_id", _id);
     }
 
+    // the expiry time the stored document is indexed with, before it's overwritten
+    String previousExpiry;
+    if (_schema.expireAfter() > 0 && !inserting)
+        previousExpiry = valueOf(ArduinoMongoDB::readDocument(_collection, _id), _schema.expiryField());
+
     if (!ArduinoMongoDB::createDocument(_document, _collection, _id))
     {
         logerr("Failed to save document: failed to create/update document");
         return false;
     }
 
+    if (_schema.expireAfter() > 0 &&
+        !updateExpiryIndex(_id, previousExpiry, get(_schema.expiryField())))
+    {
+        logerr("Failed to save document: failed to update expiry index");
+        return false;
+    }
+
+    return true;
+}
+
+bool ArduinoMongoModel::updateExpiryIndex(const String &_id, const String &previous, const String &current) const
+{
+    if (current == previous)
+        return true;
+
+    if (previous.length() != 0 &&
+        !ArduinoMongoDB::unindexExpiry(_collection, _id, previous.toInt() + _schema.expireAfter()))
+        return false;
+
+    // documents without a timestamp never expire
+    if (current.length() == 0)
+        return true;
+    return ArduinoMongoDB::indexExpiry(_collection, _id, current.toInt() + _schema.expireAfter());
+}
+
+bool ArduinoMongoModel::remove()
+{
+    String _id = get("_id");
+    if (_id.length() == 0)
+    {
+        logerr("Failed to remove document: document has no _id");
+        return false;
+    }
+
+    // the expiry index entry is removed with the document
+    if (!ArduinoMongoDB::deleteDocument(_collection, _id))
+    {
+        logerr("Failed to remove document: failed to delete document");
+        return false;
+    }
     return true;
 }
 
+size_t ArduinoMongoModel::deleteMany(bool (*filter)(const ArduinoMongoModel &))
+{
+    return ArduinoMongoDB::deleteMany(_collection, [&](const String &docString)
+                                      { return filter(ArduinoMongoModel(*this, docString)); });
+}
+
+size_t ArduinoMongoModel::truncate()
+{
+    return ArduinoMongoDB::truncateCollection(_collection);
+}
+
+uint32_t ArduinoMongoModel::countDocuments() const
+{
+    return ArduinoMongoDB::countDocuments(_collection);
+}
+
+uint32_t ArduinoMongoModel::estimatedSize() const
+{
+    return ArduinoMongoDB::estimatedSize(_collection);
+}
+
+size_t ArduinoMongoModel::expire(uint32_t now, size_t limit)
+{
+    return ArduinoMongoDB::expireDocuments(_collection, now, limit);
+}
+
 template <typename Callback>
 void ArduinoMongoModel::save(Callback callback)
 {
     if (!save())
     {
         callback(String(), false);
-        return false;
+        return;
     }
 
     callback(_document, true);
+}
+
+bool ArduinoMongoModel::updateOne(const String &_id, const String &update)
+{
+    String document = ArduinoMongoDB::readDocument(_collection, _id);
+    if (document.length() == 0)
+    {
+        logerr("Failed to update document: document " + _id + " not found");
+        return false;
+    }
+
+    const String previousExpiry = _schema.expireAfter() > 0 ? valueOf(document, _schema.expiryField()) : String();
+
+    if (!applyUpdate(document, update))
+        return false;
+
+    if (!ArduinoMongoDB::updateDocument(document, _collection, _id))
+    {
+        logerr("Failed to update document: failed to write document");
+        return false;
+    }
+
+    if (_schema.expireAfter() > 0 &&
+        !updateExpiryIndex(_id, previousExpiry, valueOf(document, _schema.expiryField())))
+    {
+        logerr("Failed to update document: failed to update expiry index");
+        return false;
+    }
+
+    return true;
+}
+
+bool ArduinoMongoModel::updateOne(bool (*filter)(const ArduinoMongoModel &), const String &update)
+{
+    String _id;
+    ArduinoMongoDB::findDocuments(_collection, [&](const String &docString)
+                                  {
+        if (_id.length() == 0 && filter(ArduinoMongoModel(*this, docString)))
+            _id = valueOf(docString, "_id"); });
+
+    if (_id.length() == 0)
+    {
+        logerr("Failed to update document: no match found");
+        return false;
+    }
+    return updateOne(_id, update);
+}
+
+// Reads a number given as such or as a numeric string, as set() may store it
+static bool toNumber(JsonVariant value, double &n)
+{
+    if (value.is<const char *>())
+    {
+        const char *str = value.as<const char *>();
+        char *end;
+        n = strtod(str, &end);
+        return end != str && *end == '\0';
+    }
+    if (!value.is<long>() && !value.is<double>())
+        return false;
+    n = value.as<double>();
+    return true;
+}
+
+// Reads an integer given as such or as a string of digits
+static bool toInteger(JsonVariant value, long &n)
+{
+    if (value.is<const char *>())
+    {
+        const char *str = value.as<const char *>();
+        char *end;
+        n = strtol(str, &end, 10);
+        return end != str && *end == '\0';
+    }
+    if (!value.is<long>())
+        return false;
+    n = value.as<long>();
+    return true;
+}
+
+bool ArduinoMongoModel::applyUpdate(String &document, const String &update) const
+{
+    // the document and the update share one buffer, so values can be copied between them
+    const size_t capacity = JSON_OBJECT_SIZE(8) + document.length() + update.length();
+    DynamicJsonBuffer jsonBuffer(capacity);
+    JsonObject &json = jsonBuffer.parseObject(document);
+    JsonObject &operators = jsonBuffer.parseObject(update);
+    if (!json.success() || !operators.success())
+    {
+        logerr("Failed to update document: failed to parse JSON");
+        return false;
+    }
+
+    for (auto op : operators)
+    {
+        const String name = op.key;
+        JsonObject &fields = op.value.as<JsonObject &>();
+        if (!fields.success())
+        {
+            logerr("Failed to update document: operator " + name + " expects an object");
+            return false;
+        }
+
+        for (auto field : fields)
+        {
+            const String key = field.key;
+            if (key == "_id")
+            {
+                logerr("Failed to update document: _id can't be updated");
+                return false;
+            }
+
+            if (name == "$set")
+            {
+                json[key] = field.value;
+            }
+            else if (name == "$inc")
+            {
+                double by, value = 0;
+                if (!toNumber(field.value, by))
+                {
+                    logerr("Failed to update document: $inc of " + key + " expects a number");
+                    return false;
+                }
+                if (json.containsKey(key) && !toNumber(json[key], value))
+                {
+                    logerr("Failed to update document: field " + key + " is not a number");
+                    return false;
+                }
+
+                // the result is stored as a number; integers stay integral, as the schema's
+                // Int check compares their text
+                long byInteger, integer = 0;
+                if (toInteger(field.value, byInteger) && (!json.containsKey(key) || toInteger(json[key], integer)))
+                    json[key] = integer + byInteger;
+                else
+                    json[key] = value + by;
+            }
+            else if (name == "$push")
+            {
+                JsonArray &array = json.containsKey(key) ? json[key].as<JsonArray &>() : json.createNestedArray(key);
+                if (!array.success())
+                {
+                    logerr("Failed to update document: field " + key + " is not an array");
+                    return false;
+                }
+                array.add(field.value);
+            }
+            else
+            {
+                logerr("Failed to update document: unsupported operator " + name);
+                return false;
+            }
+
+            if (!_schema.verifyField(key, json))
+            {
+                logerr("Failed to update document: schema verification of " + key + " failed");
+                return false;
+            }
+        }
+    }
+
+    document = "";
+    json.printTo(document);
     return true;
 }
 
@@ -21,6 +21,27 @@ private:
      */
     String nextID() const;
 
+    /**
+     * @returns the string value of `key` in `document`, or empty string if key does not exist
+     */
+    static String valueOf(const String &document, const String &key);
+
+    /**
+     * @brief Moves a document's entry in the expiry index to its new expiry time
+     * @param _id document's ID
+     * @param previous expiry timestamp of the stored document, empty if there is none
+     * @param current expiry timestamp of the new document, empty if there is none
+     */
+    bool updateExpiryIndex(const String &_id, const String &previous, const String &current) const;
+
+    /**
+     * @brief Applies update operators to a document, validating only the fields they touch
+     * @param document JSON string of the document, replaced by the updated document
+     * @param update JSON string of the update operators
+     * @returns true if the update is valid and was applied
+     */
+    bool applyUpdate(String &document, const String &update) const;
+
 public:
     ArduinoMongoModel(const String &collection, const ArduinoMongoSchema &schema,
                       bool (*verify)(const ArduinoMongoModel &),
@@ -66,6 +87,29 @@ public:
     template <typename Callback>
     void save(Callback callback);
 
+    /**
+     * @brief Updates fields of a stored document in place, without loading it into a model.
+     * Only the fields touched by the update are validated against the schema.
+     * Supported operators:
+     * - `$set`: `{"$set": {"name": "Jane"}}` sets fields to the given values
+     * - `$inc`: `{"$inc": {"age": 1}}` adds to numeric fields, missing fields are set
+     * - `$push`: `{"$push": {"tags": "admin"}}` appends to array fields, missing fields are created
+     * @param _id ID of the document to update
+     * @param update JSON string of the update operators
+     * @returns true if operation is successful, otherwise false
+     */
+    bool updateOne(const String &_id, const String &update);
+
+    /**
+     * @brief Updates fields of the first document matching a custom function.
+     * See updateOne(_id, update) for the supported operators.
+     * @param filter this function is called with a ArduinoMongoModel object of each document
+     * in this collection. It should return true for the document to update.
+     * @param update JSON string of the update operators
+     * @returns true if a document matched and was updated, otherwise false
+     */
+    bool updateOne(bool (*filter)(const ArduinoMongoModel &), const String &update);
+
     // -------------- READ OPERATIONS --------------
 
     /**
@@ -126,6 +170,16 @@ public:
     template <typename Callback>
     void find(bool (*find_cb)(const String &), Callback callback);
 
+    /**
+     * @returns the number of documents in this collection, without reading them
+     */
+    uint32_t countDocuments() const;
+
+    /**
+     * @returns the bytes of flash used by the documents of this collection, without reading them
+     */
+    uint32_t estimatedSize() const;
+
     // -------------- DELETE OPERATION --------------
 
     /**
@@ -142,6 +196,30 @@ public:
      */
     template <typename Callback>
     void remove(Callback);
+
+    /**
+     * @brief deletes all documents of this collection matching a custom function
+     * @param filter this function is called with a ArduinoMongoModel object of each document
+     * in this collection. It should return true for documents to delete.
+     * @returns the number of documents deleted
+     */
+    size_t deleteMany(bool (*filter)(const ArduinoMongoModel &));
+
+    /**
+     * @brief deletes all documents of this collection
+     * @returns the number of documents deleted
+     */
+    size_t truncate();
+
+    /**
+     * @brief deletes documents of this collection that expired at or before `now`.
+     * Only for schemas with an expiry (see ArduinoMongoSchema::setExpiry). Call it
+     * regularly: each call deletes at most `limit` documents.
+     * @param now current time, in the unit of the schema's expiry field
+     * @param limit maximum number of documents to delete
+     * @returns the number of documents deleted
+     */
+    size_t expire(uint32_t now, size_t limit = ARDUINO_MONGODB_TTL_SLICE);
 };
 
 #endif // ARDUINO_MNGO_MODEL_HEADER
\ No newline at end of file
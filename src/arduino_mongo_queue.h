@@ -0,0 +1,55 @@
+#ifndef ARDUINO_MONGO_QUEUE_HEADER
+#define ARDUINO_MONGO_QUEUE_HEADER
+
+#include <atomic>
+#include <stddef.h>
+#include <utility>
+
+
+// ######################################
+// ------------- SPSC QUEUE -------------
+// ######################################
+
+/* Lock-free single-producer/single-consumer ring buffer.
+ * - Exactly one task may call `push` and exactly one task may call `pop`
+ * - `Capacity` must be a power of two; one slot is kept free to tell full from empty
+ * */
+template <typename T, size_t Capacity>
+class ArduinoMongoQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "ArduinoMongoQueue capacity must be a power of two");
+
+public:
+    // Moves `item` into the queue. Returns false if the queue is full.
+    bool push(T &&item)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        const size_t next = (head + 1) & (Capacity - 1);
+        if (next == _tail.load(std::memory_order_acquire))
+            return false;
+
+        _items[head] = std::move(item);
+        _head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Moves the oldest item into `item`. Returns false if the queue is empty.
+    bool pop(T &item)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(_items[tail]);
+        _tail.store((tail + 1) & (Capacity - 1), std::memory_order_release);
+        return true;
+    }
+
+private:
+    T _items[Capacity];
+    std::atomic<size_t> _head{0};
+    std::atomic<size_t> _tail{0};
+};
+
+#endif // ARDUINO_MONGO_QUEUE_HEADER
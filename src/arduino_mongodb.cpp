@@ -1,9 +1,23 @@
 #include "arduino_mongodb.h"
+#include <ArduinoJson.h>
+#include <algorithm>
+#include <float.h>
+#include <limits>
 
 // --------------------------------------------
 // ---------- ArduinoMongoDB ---------------
 // --------------------------------------------
 
+String ArduinoMongoDB::_currentURI;
+std::map<String, ArduinoMongoDB::CollectionInfo> ArduinoMongoDB::_catalog;
+uint32_t ArduinoMongoDB::_catalogGeneration = 0;
+bool ArduinoMongoDB::_countersStale = false;
+uint32_t ArduinoMongoDB::_unsavedCounters = 0;
+std::map<String, ArduinoMongoCodec> ArduinoMongoDB::_codecs;
+bool ArduinoMongoDB::_changeLogEnabled = false;
+uint32_t ArduinoMongoDB::_firstChange = 1;
+uint32_t ArduinoMongoDB::_lastChange = 0;
+
 ArduinoMongoDB::ArduinoMongoDB()
 {
     // Create the ArduinoMongoDB path if it does not exist.
@@ -22,6 +36,10 @@ bool ArduinoMongoDB::connect(const String &db)
         db_name = db_name.substring(10);
     }
     
+    // Counters of the current database are saved before switching
+    if(connected())
+        flush();
+
     // Check if this database exists before, otherwise initialize a new database
     bool success = true;
     if(!little_fs.exists(String(ARDUINO_MONGODB_PATH) + "/" + db_name))
@@ -29,6 +47,8 @@ bool ArduinoMongoDB::connect(const String &db)
 
     if (success){
         _currentURI = String(ARDUINO_MONGODB_PATH) + "/" + db_name + "/";
+        loadCatalog();
+        loadChangeLog();
     }
     return success;
 }
@@ -41,29 +61,432 @@ String ArduinoMongoDB::currentDatabase()
         return "";
 }
 
+bool ArduinoMongoDB::flush()
+{
+    if(!connected())
+        return false;
+    if(_unsavedCounters == 0 && !_countersStale)
+        return true;
+    return saveCatalog();
+}
+
+
+        // ------------------ CATALOG ------------------
+/* The catalog lists the collections of a database with their storage options and counters.
+ * It is read once at connect, all collection lookups are then done in memory.
+ * Generation N is written to slot N % 2: loading picks the newest slot that parses.
+ * */
+void ArduinoMongoDB::loadCatalog()
+{
+    _catalog.clear();
+    _codecs.clear();
+    _catalogGeneration = 0;
+    _countersStale = false;
+    _unsavedCounters = 0;
+
+    bool loaded = false;
+    bool counted = true;
+    for(uint32_t slot = 0; slot < 2; slot++){
+        const String filename = catalogFilename(slot);
+        if(!little_fs.exists(filename))
+            continue;
+
+        // An interrupted write leaves a slot that doesn't parse: skip it
+        const String content = little_fs.readFile(filename);
+        DynamicJsonBuffer jsonBuffer(content.length());
+        JsonObject &json = jsonBuffer.parseObject(content);
+        if(!json.success())
+            continue;
+
+        uint32_t generation = json["gen"].as<uint32_t>();
+        if(loaded && generation <= _catalogGeneration)
+            continue;
+
+        std::map<String, CollectionInfo> catalog;
+        JsonObject &collections = json["collections"].as<JsonObject &>();
+        for(auto collection: collections)
+            catalog[collection.key] = readInfo(collection.value.as<JsonObject &>());
+
+        _catalog = catalog;
+        _catalogGeneration = generation;
+        counted = !json.containsKey("counted") || json["counted"].as<bool>();
+        loaded = true;
+    }
+
+    if(!loaded)
+        rebuildCatalog();
+
+    for(auto &entry: _catalog){
+        // Columnar IDs are row numbers, which must stay dense: continue after the last row
+        if(!entry.second.options.columns.empty())
+            entry.second.nextID = rowCount(entry.first) + 1;
+        if(!entry.second.options.dictionary.empty())
+            _codecs[entry.first] = ArduinoMongoCodec(entry.second.options.dictionary);
+    }
+
+    // The database was last used without saving its counters: recount them
+    if(!counted)
+    {
+        logwarn("Recounting documents of database " + currentDatabase() + ": counters were not saved");
+        for(auto &entry: _catalog)
+            recountCollection(entry.first);
+        if(!saveCatalog())
+            logerr("Failed to save catalog of database " + currentDatabase());
+    }
+}
+
+void ArduinoMongoDB::rebuildCatalog()
+{
+    // Every directory not reserved by the database is a collection. Document IDs
+    // continue after the largest numeric ID found, counters start from what's stored.
+    Dir dir = little_fs.openDir(_currentURI);
+    while(dir.next()){
+        if(!dir.isDirectory() || dir.fileName().startsWith("$"))
+            continue;
+
+        CollectionInfo &info = _catalog[dir.fileName()];
+        Dir docs = little_fs.openDir(String(_currentURI) + dir.fileName());
+        while(docs.next()){
+            uint32_t ID = docs.fileName().toInt();
+            if(ID >= info.nextID)
+                info.nextID = ID + 1;
+            info.count++;
+            info.size += docs.fileSize();
+        }
+        info.reservedID = info.nextID;
+    }
+
+    if(!saveCatalog())
+        logerr("Failed to save catalog of database " + currentDatabase());
+}
+
+ArduinoMongoDB::CollectionInfo ArduinoMongoDB::readInfo(JsonObject &entry)
+{
+    CollectionInfo info;
+    info.options.compressed = entry["compressed"].as<bool>();
+    JsonArray &dictionary = entry["dictionary"].as<JsonArray &>();
+    for(auto key: dictionary)
+        info.options.dictionary.push_back(key.as<String>());
+    info.options.expireAfter = entry["expireAfter"].as<uint32_t>();
+    info.options.expiryField = entry["expiryField"].as<String>();
+    info.nextID = entry["nextID"].as<uint32_t>();
+    info.reservedID = info.nextID;
+    info.count = entry["count"].as<uint32_t>();
+    info.size = entry["size"].as<uint32_t>();
+    JsonArray &columns = entry["columns"].as<JsonArray &>();
+    for(auto column: columns)
+        info.options.columns.push_back({column["name"].as<String>(), (DBType)column["type"].as<int>()});
+    return info;
+}
+
+void ArduinoMongoDB::writeInfo(const CollectionInfo &info, JsonObject &entry)
+{
+    entry["compressed"] = info.options.compressed;
+    JsonArray &dictionary = entry.createNestedArray("dictionary");
+    for(const String &key: info.options.dictionary)
+        dictionary.add(key);
+    entry["expireAfter"] = info.options.expireAfter;
+    entry["expiryField"] = info.options.expiryField;
+    entry["nextID"] = info.reservedID;
+    entry["count"] = info.count;
+    entry["size"] = info.size;
+    JsonArray &columns = entry.createNestedArray("columns");
+    for(const ArduinoMongoColumn &column: info.options.columns){
+        JsonObject &field = columns.createNestedObject();
+        field["name"] = column.name;
+        field["type"] = (int)column.type;
+    }
+}
+
+bool ArduinoMongoDB::saveCatalog(bool counted)
+{
+    DynamicJsonBuffer jsonBuffer(JSON_OBJECT_SIZE(3) + _catalog.size() * JSON_OBJECT_SIZE(6));
+    JsonObject &json = jsonBuffer.createObject();
+    json["gen"] = _catalogGeneration + 1;
+    json["counted"] = counted;
+
+    JsonObject &collections = json.createNestedObject("collections");
+    for(auto &entry: _catalog)
+        writeInfo(entry.second, collections.createNestedObject(entry.first));
+
+    String content;
+    json.printTo(content);
+    if(!little_fs.writeFile(catalogFilename(_catalogGeneration + 1), content))
+        return false;
+
+    _catalogGeneration++;
+    _countersStale = !counted;
+    if(counted)
+        _unsavedCounters = 0;
+    return true;
+}
+
+bool ArduinoMongoDB::beginCounterUpdate()
+{
+    if(_countersStale)
+        return true;
+    if(!saveCatalog(false))
+    {
+        logerr("Failed to update counters: failed to save catalog");
+        return false;
+    }
+    return true;
+}
+
+void ArduinoMongoDB::endCounterUpdate()
+{
+    if(++_unsavedCounters >= ARDUINO_MONGODB_COUNTER_FLUSH && !saveCatalog())
+        logerr("Failed to save counters of database " + currentDatabase());
+}
+
 
         // ------------------ COLLECTION OPERATIONS ------------------
 bool ArduinoMongoDB::createCollection(const String &collection_name)
+{
+    if(hasCollection(collection_name))
+        return true;
+    return createCollection(collection_name, ArduinoMongoCollectionOptions());
+}
+
+// Returns true if two lists of columns are the same
+static bool sameColumns(const std::vector<ArduinoMongoColumn> &a, const std::vector<ArduinoMongoColumn> &b)
+{
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); i++){
+        if(a[i].name != b[i].name || a[i].type != b[i].type)
+            return false;
+    }
+    return true;
+}
+
+// Returns true if two sets of collection options are the same
+static bool sameOptions(const ArduinoMongoCollectionOptions &a, const ArduinoMongoCollectionOptions &b)
+{
+    return a.compressed == b.compressed && a.dictionary == b.dictionary && a.expireAfter == b.expireAfter &&
+           a.expiryField == b.expiryField && sameColumns(a.columns, b.columns);
+}
+
+bool ArduinoMongoDB::createCollection(const String &collection_name, const ArduinoMongoCollectionOptions &options)
 {
     if(!connected())
         return false;
-    
+
+    // Names starting with `$` are reserved for the database's own files
+    if(collection_name.startsWith("$"))
+    {
+        logerr("Failed to create collection: invalid collection name " + collection_name);
+        return false;
+    }
+
+    auto entry = _catalog.find(collection_name);
+    bool exists = entry != _catalog.end();
+    ArduinoMongoCollectionOptions applied = options;
+    if(exists && entry->second.count > 0)
+    {
+        // Stored documents can't change between files and columns
+        if(!sameColumns(entry->second.options.columns, options.columns))
+        {
+            logerr("Failed to create collection: " + collection_name + " has documents in another storage format");
+            return false;
+        }
+
+        // Dictionary codes are positional: keep the stored ones and only append new keys, so
+        // that stored documents still decode. Its codec is kept even if compression is disabled.
+        applied.dictionary = entry->second.options.dictionary;
+        for(const String &key: options.dictionary){
+            if(std::find(applied.dictionary.begin(), applied.dictionary.end(), key) == applied.dictionary.end())
+                applied.dictionary.push_back(key);
+        }
+    }
+
+    // Nothing to do if the catalog already has this collection with these options
+    if(exists && sameOptions(entry->second.options, applied))
+        return true;
+
     // Check if this collection exists before, otherwise initialize a new collection
-    bool success = true;
-    if(!little_fs.exists(String(_currentURI) + collection_name))
-        success = little_fs.mkdir(String(_currentURI) + collection_name);
-    
-    // TODO: Add necessary indexes, and other config. files to the collection
-    return success;
+    const String path = String(_currentURI) + collection_name;
+    if(!exists && !little_fs.exists(path) && !little_fs.mkdir(path))
+        return false;
+
+    // Expiring collections keep an index of expiry times
+    if(applied.expireAfter > 0 && !(exists && entry->second.options.expireAfter > 0))
+    {
+        const String ttl = String(_currentURI) + ARDUINO_MONGODB_TTL;
+        if(!little_fs.exists(ttl) && !little_fs.mkdir(ttl))
+            return false;
+        if(!little_fs.exists(ttl + "/" + collection_name) && !little_fs.mkdir(ttl + "/" + collection_name))
+            return false;
+    }
+
+    _catalog[collection_name].options = applied;
+    if(!applied.dictionary.empty())
+        _codecs[collection_name] = ArduinoMongoCodec(applied.dictionary);
+    else
+        _codecs.erase(collection_name);
+    return saveCatalog();
 }
 
 bool ArduinoMongoDB::deleteCollection(const String &collection_name)
 {
-    if(!connected())
+    if(!connected() || !hasCollection(collection_name))
         return false;
-    
-    // Remove the collection directory if it exists
-    return little_fs.rmdir(String(_currentURI) + collection_name);
+
+    size_t removed;
+    return removeCollection(collection_name, removed);
+}
+
+// Returns `str` as a quoted JSON string
+static String jsonString(const String &str)
+{
+    static const char hex[] = "0123456789abcdef";
+    String res = "\"";
+    res.reserve(str.length() + 2);
+    for(size_t i = 0; i < str.length(); i++){
+        char c = str[i];
+        if(c == '"' || c == '\\')
+        {
+            res += '\\';
+            res += c;
+        }
+        else if((uint8_t)c < 0x20)
+        {
+            res += "\\u00";
+            res += hex[(uint8_t)c >> 4];
+            res += hex[c & 0xF];
+        }
+        else
+            res += c;
+    }
+    res += '"';
+    return res;
+}
+
+/* Removes everything in directory `path`, sub directories included, and returns the number
+ * of files removed. Removing entries while listing a directory can make the listing skip
+ * entries, so it repeats until a pass removes nothing.
+ * */
+static size_t removeFiles(const String &path)
+{
+    size_t removed = 0;
+    size_t pass;
+    do{
+        pass = 0;
+        Dir dir = little_fs.openDir(path);
+        while(dir.next()){
+            const String entry = path + "/" + dir.fileName();
+            if(dir.isDirectory())
+            {
+                removed += removeFiles(entry);
+                pass += little_fs.rmdir(entry);
+            }
+            else if(little_fs.remove(entry))
+            {
+                removed++;
+                pass++;
+            }
+        }
+    } while(pass > 0);
+    return removed;
+}
+
+size_t ArduinoMongoDB::clearCollection(const String &collection_name)
+{
+    CollectionInfo &info = _catalog[collection_name];
+    const uint32_t count = info.count;
+    beginCounterUpdate();
+
+    // Document files, or column files, and the expiry index buckets
+    const String path = String(_currentURI) + collection_name;
+    removeFiles(path);
+    if(info.options.expireAfter > 0)
+        removeFiles(String(_currentURI) + ARDUINO_MONGODB_TTL + "/" + collection_name);
+
+    // Files that failed to be removed keep their documents: count what's left
+    Dir dir = little_fs.openDir(path);
+    if(dir.next())
+    {
+        logerr("Failed to remove every document of collection " + collection_name);
+        recountCollection(collection_name);
+        return count > info.count? count - info.count : 0;
+    }
+
+    // Columnar IDs are row numbers: restart them so that rows stay dense
+    if(!info.options.columns.empty())
+        info.nextID = 1;
+    info.count = 0;
+    info.size = 0;
+    return count;
+}
+
+size_t ArduinoMongoDB::truncateCollection(const String &collection_name)
+{
+    if(!connected() || !hasCollection(collection_name))
+        return 0;
+
+    size_t removed = clearCollection(collection_name);
+    if(!saveCatalog())
+        logerr("Failed to save counters of collection " + collection_name);
+
+    // The documents are removed either way, a truncation missing from the log is reported
+    if(!logChange("c", collection_name, "", "{\"truncate\":" + jsonString(collection_name) + "}"))
+        logerr("Failed to record truncation of collection " + collection_name);
+    return removed;
+}
+
+size_t ArduinoMongoDB::dropCollection(const String &collection_name)
+{
+    size_t removed = 0;
+    if(connected() && hasCollection(collection_name))
+        removeCollection(collection_name, removed);
+    return removed;
+}
+
+bool ArduinoMongoDB::removeCollection(const String &collection_name, size_t &removed)
+{
+    removed = clearCollection(collection_name);
+
+    const String ttl = String(_currentURI) + ARDUINO_MONGODB_TTL + "/" + collection_name;
+    if(_catalog[collection_name].options.expireAfter > 0)
+        little_fs.rmdir(ttl);
+
+    // Remove the collection directory, now empty
+    if(!little_fs.rmdir(String(_currentURI) + collection_name))
+    {
+        logerr("Failed to drop collection: failed to remove directory of " + collection_name);
+        saveCatalog();
+        return false;
+    }
+
+    _catalog.erase(collection_name);
+    _codecs.erase(collection_name);
+    if(!saveCatalog())
+        logerr("Failed to save catalog of database " + currentDatabase());
+
+    // The collection is dropped either way, but a drop missing from the log must be reported
+    if(!logChange("c", collection_name, "", "{\"drop\":" + jsonString(collection_name) + "}"))
+    {
+        logerr("Failed to record drop of collection " + collection_name);
+        return false;
+    }
+    return true;
+}
+
+bool ArduinoMongoDB::hasCollection(const String &collection_name)
+{
+    return _catalog.find(collection_name) != _catalog.end();
+}
+
+uint32_t ArduinoMongoDB::countDocuments(const String &collection_name)
+{
+    auto entry = _catalog.find(collection_name);
+    return entry != _catalog.end()? entry->second.count : 0;
+}
+
+uint32_t ArduinoMongoDB::estimatedSize(const String &collection_name)
+{
+    auto entry = _catalog.find(collection_name);
+    return entry != _catalog.end()? entry->second.size : 0;
 }
 
 
@@ -74,38 +497,122 @@ bool ArduinoMongoDB::createDocument(const String &document, const String &collec
         return false;
     
     // Check if the collection exists. Return false if it does not.
-    if(!little_fs.exists(String(_currentURI) + collection))
+    if(!hasCollection(collection))
         return false;
 
-    // Create the document file
-    return little_fs.writeFile(docFilename(collection, ID), document);
+    bool exists;
+    if(isColumnar(collection))
+    {
+        if(!writeRow(document, collection, ID, exists))
+            return false;
+    }
+    else
+    {
+        // An existing document is overwritten: it's an update, not an insert
+        size_t previousSize = 0;
+        exists = ArduinoMongoFS::size(docFilename(collection, ID), previousSize);
+
+        // Create the document file, encoded if the collection is compressed
+        auto codec = _codecs.find(collection);
+        const bool encode = _catalog[collection].options.compressed && codec != _codecs.end();
+        const String stored = encode? codec->second.encode(document) : document;
+
+        // Counters only change for inserts and updates that change the size
+        const bool counters = !exists || previousSize != stored.length();
+        if(counters && !beginCounterUpdate())
+            return false;
+        if(!little_fs.writeFile(docFilename(collection, ID), stored))
+            return false;
+
+        if(counters)
+        {
+            CollectionInfo &info = _catalog[collection];
+            if(!exists)
+                info.count++;
+            info.size = info.size - previousSize + stored.length();
+            endCounterUpdate();
+        }
+    }
+
+    // The document is stored either way, but a change missing from the log must be reported
+    return logChange(exists? "u":"i", collection, ID, document);
 }
 
 String ArduinoMongoDB::readDocument(const String &collection, const String &ID)
 {
     if(!connected())
         return "";
+
+    if(isColumnar(collection))
+        return readRow(collection, ID);
     
     // Read the document file
-    return little_fs.readFile(docFilename(collection, ID));
+    String document = little_fs.readFile(docFilename(collection, ID));
+    if(!ArduinoMongoCodec::isEncoded(document))
+        return document;
+
+    // Decode compressed documents with the collection's dictionary
+    auto codec = _codecs.find(collection);
+    if(codec == _codecs.end())
+    {
+        logerr("Failed to read document: collection " + collection + " is not open for compression");
+        return "";
+    }
+    return codec->second.decode(document);
 }
 
-template <typename T>
-void ArduinoMongoDB::findDocuments(const String &collection, T callback)
+String ArduinoMongoDB::nextID(const String &collection)
 {
-    if(!connected())
-        return;
-    
-    // Check if the collection exists. Return false if it does not.
-    if(!little_fs.exists(String(_currentURI) + collection))
-        return;
-    
-    // Find all documents in the collection
-    Dir dir = little_fs.openDir(String(_currentURI) + collection);
-    while(dir.next()){
-        // Call the callback function with the document
-        callback(little_fs.readFile(dir.fileName()));
+    auto entry = _catalog.find(collection);
+    if(entry == _catalog.end())
+        return "";
+
+    // Reserve a block of IDs before handing one out, so that no ID is reused after a
+    // restart. The catalog is only saved when the block runs out.
+    CollectionInfo &info = entry->second;
+    if(info.nextID >= info.reservedID)
+    {
+        const uint32_t reserved = info.reservedID;
+        info.reservedID = info.nextID + ARDUINO_MONGODB_ID_BLOCK;
+        if(!saveCatalog())
+        {
+            info.reservedID = reserved;
+            logerr("Failed to create document ID: failed to save catalog");
+            return "";
+        }
+    }
+    return String(info.nextID++);
+}
+
+void ArduinoMongoDB::scanReader(void *arg)
+{
+#if defined(ARDUINO_MONGODB_PARALLEL_SCAN)
+    ScanContext *ctx = static_cast<ScanContext *>(arg);
+
+    // The directory is closed at the end of this block: vTaskDelete doesn't return
+    {
+        Dir dir = little_fs.openDir(ctx->path);
+        while(dir.next()){
+            String doc = little_fs.readFile(ctx->path + "/" + dir.fileName());
+            if(ArduinoMongoCodec::isEncoded(doc))
+                doc = ctx->hasCodec? ctx->codec.decode(doc) : String();
+
+            // Wait for the parser to free a slot if the queue is full
+            xSemaphoreTake(ctx->space, portMAX_DELAY);
+            ctx->queue.push(std::move(doc));
+            xSemaphoreGive(ctx->items);
+        }
     }
+
+    // Wake the parser without a document: the listing is done
+    xSemaphoreGive(ctx->items);
+
+    // `ctx` lives on the caller's stack: this must be the last access to it
+    xTaskNotifyGive(ctx->consumer);
+    vTaskDelete(nullptr);
+#else
+    (void)arg;
+#endif
 }
 
 bool ArduinoMongoDB::updateDocument(const String &document, const String &collection, const String &ID)
@@ -119,9 +626,1091 @@ bool ArduinoMongoDB::deleteDocument(const String &collection, const String &ID)
         return false;
     
     // Check if the collection exists. Return false if it does not.
-    if(!little_fs.exists(String(_currentURI) + collection))
+    if(!hasCollection(collection))
         return false;
     
-    // Remove the document file
-    return little_fs.remove(docFilename(collection, ID));
+    if(!removeDocument(collection, ID))
+        return false;
+    return logChange("d", collection, ID, "");
+}
+
+size_t ArduinoMongoDB::removeDocuments(const String &collection, const std::vector<String> &IDs)
+{
+    size_t removed = 0;
+    for(const String &ID: IDs){
+        if(!removeDocument(collection, ID))
+            continue;
+        removed++;
+
+        // Stop at a change that can't be recorded, so that no later one is logged past it
+        if(!logChange("d", collection, ID, ""))
+            break;
+    }
+
+    // Counters are saved once for all documents
+    if(removed > 0 && !flush())
+        logerr("Failed to save counters of collection " + collection);
+    return removed;
+}
+
+bool ArduinoMongoDB::removeDocument(const String &collection, const String &ID, bool unindex)
+{
+    // Drop the expiry index entry first, while the document still tells its expiry time
+    const ArduinoMongoCollectionOptions &options = _catalog[collection].options;
+    if(unindex && options.expireAfter > 0 && options.expiryField.length() != 0)
+    {
+        const String document = readDocument(collection, ID);
+        DynamicJsonBuffer jsonBuffer(document.length());
+        JsonObject &json = jsonBuffer.parseObject(document);
+        if(json.success() && json.containsKey(options.expiryField) &&
+           !unindexExpiry(collection, ID, json[options.expiryField].as<String>().toInt() + options.expireAfter))
+            return false;
+    }
+
+    if(isColumnar(collection))
+    {
+        if(!removeRow(collection, ID))
+            return false;
+    }
+    else
+    {
+        // Remove the document file
+        size_t size = 0;
+        if(!ArduinoMongoFS::size(docFilename(collection, ID), size) || !beginCounterUpdate())
+            return false;
+        if(!little_fs.remove(docFilename(collection, ID)))
+            return false;
+
+        CollectionInfo &info = _catalog[collection];
+        info.count--;
+        info.size -= size;
+        endCounterUpdate();
+    }
+    return true;
+}
+
+bool ArduinoMongoDB::hasDocument(const String &collection, const String &ID)
+{
+    if(isColumnar(collection))
+        return hasRow(collection, ID);
+    size_t size = 0;
+    return ArduinoMongoFS::size(docFilename(collection, ID), size);
+}
+
+
+        // ------------------ COLUMNAR STORAGE ------------------
+// Values that mark a missing field in a column. INT32_MIN is outside the range of Int columns,
+// NAN can't be stored in a Float or Double column.
+#define MISSING_INT INT32_MIN
+#define MISSING_BOOLEAN 0xFF
+
+// Returns the bytes a value of type `type` takes in a column
+static size_t columnWidth(DBType type)
+{
+    switch(type)
+    {
+    case DBType::Int:
+        return sizeof(int32_t);
+    case DBType::Float:
+        return sizeof(float);
+    case DBType::Double:
+        return sizeof(double);
+    default:
+        return sizeof(uint8_t);
+    }
+}
+
+// Returns the bytes a row of `columns` takes, with its `$live` byte
+static size_t rowWidth(const std::vector<ArduinoMongoColumn> &columns)
+{
+    size_t width = 1;
+    for(const ArduinoMongoColumn &column: columns)
+        width += columnWidth(column.type);
+    return width;
+}
+
+// Returns the column named `name`, or nullptr if there is none
+static const ArduinoMongoColumn *findColumn(const std::vector<ArduinoMongoColumn> &columns, const String &name)
+{
+    for(const ArduinoMongoColumn &column: columns){
+        if(column.name == name)
+            return &column;
+    }
+    return nullptr;
+}
+
+// Returns the row of document ID `ID`, or -1 if it isn't a number from 1
+static int32_t rowOf(const String &ID)
+{
+    long n = ID.toInt();
+    if(n < 1 || String(n) != ID)
+        return -1;
+    return n - 1;
+}
+
+// Reads a number, or a string holding a number as stored by ArduinoMongoModel::set
+static bool toNumber(JsonVariant value, double &n)
+{
+    if(value.is<const char *>())
+    {
+        const char *str = value.as<const char *>();
+        char *end;
+        n = strtod(str, &end);
+        return end != str && *end == '\0';
+    }
+    if(!value.is<long>() && !value.is<double>())
+        return false;
+    n = value.as<double>();
+    return true;
+}
+
+/* Encodes a document value into `cell`. Values given as strings are converted, as the
+ * schema accepts them. Returns false if the value has the wrong type or is out of range:
+ * Int columns hold integers from -2147483647 to 2147483647, Float and Double columns
+ * finite numbers.
+ * */
+static bool encodeValue(DBType type, JsonVariant value, uint8_t *cell)
+{
+    double n;
+    switch(type)
+    {
+    case DBType::Int:
+    {
+        if(!toNumber(value, n) || n != floor(n) || n <= MISSING_INT || n > INT32_MAX)
+            return false;
+        int32_t i = (int32_t)n;
+        memcpy(cell, &i, sizeof(i));
+        return true;
+    }
+    case DBType::Float:
+    {
+        if(!toNumber(value, n) || !isfinite(n) || fabs(n) > FLT_MAX)
+            return false;
+        float f = n;
+        memcpy(cell, &f, sizeof(f));
+        return true;
+    }
+    case DBType::Double:
+        if(!toNumber(value, n) || !isfinite(n))
+            return false;
+        memcpy(cell, &n, sizeof(n));
+        return true;
+    case DBType::Boolean:
+    {
+        String str = value.is<bool>()? String() : value.as<String>();
+        if(!value.is<bool>() && !str.equalsIgnoreCase("true") && !str.equalsIgnoreCase("false"))
+            return false;
+        cell[0] = (value.is<bool>()? value.as<bool>() : str.equalsIgnoreCase("true"))? 1 : 0;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Encodes a missing value into `cell`
+static void encodeMissing(DBType type, uint8_t *cell)
+{
+    int32_t missingInt = MISSING_INT;
+    float missingFloat = NAN;
+    double missingDouble = NAN;
+    switch(type)
+    {
+    case DBType::Int:
+        memcpy(cell, &missingInt, sizeof(missingInt));
+        break;
+    case DBType::Float:
+        memcpy(cell, &missingFloat, sizeof(missingFloat));
+        break;
+    case DBType::Double:
+        memcpy(cell, &missingDouble, sizeof(missingDouble));
+        break;
+    default:
+        cell[0] = MISSING_BOOLEAN;
+    }
+}
+
+// Formats a number with the fewest significant digits that read back as the same value
+template <typename T>
+static String formatNumber(T n)
+{
+    char text[32];
+    for(int digits = std::numeric_limits<T>::digits10; ; digits++){
+        snprintf(text, sizeof(text), "%.*g", digits, (double)n);
+        if((T)strtod(text, nullptr) == n || digits >= std::numeric_limits<T>::max_digits10)
+            break;
+    }
+    return String(text);
+}
+
+// Returns the JSON text of the value in `cell`, or an empty string if it is missing
+static String decodeValue(DBType type, const uint8_t *cell)
+{
+    switch(type)
+    {
+    case DBType::Int:
+    {
+        int32_t n;
+        memcpy(&n, cell, sizeof(n));
+        return n == MISSING_INT? String() : String(n);
+    }
+    case DBType::Float:
+    {
+        float n;
+        memcpy(&n, cell, sizeof(n));
+        return isnan(n)? String() : formatNumber(n);
+    }
+    case DBType::Double:
+    {
+        double n;
+        memcpy(&n, cell, sizeof(n));
+        return isnan(n)? String() : formatNumber(n);
+    }
+    default:
+        return cell[0] == MISSING_BOOLEAN? String() : String(cell[0]? "true" : "false");
+    }
+}
+
+// Overloads telling missing values apart in a column scan
+static bool isMissing(int32_t n) {return n == MISSING_INT;}
+static bool isMissing(float n) {return isnan(n);}
+static bool isMissing(double n) {return isnan(n);}
+static bool isMissing(uint8_t n) {return n == MISSING_BOOLEAN;}
+
+/* Reads the next `rows` values of type T from an open column file, as doubles.
+ * One typed loop per chunk, without per-value branches on the column type.
+ * */
+template <typename T>
+static bool decodeColumn(File &file, size_t rows, double *values, uint8_t *present)
+{
+    T buffer[ARDUINO_MONGODB_COLUMN_CHUNK];
+    if(file.read((uint8_t *)buffer, rows * sizeof(T)) != rows * sizeof(T))
+        return false;
+    for(size_t i = 0; i < rows; i++){
+        values[i] = buffer[i];
+        present[i] = present[i] == 1 && !isMissing(buffer[i]);
+    }
+    return true;
+}
+
+bool ArduinoMongoDB::isColumnar(const String &collection)
+{
+    auto entry = _catalog.find(collection);
+    return entry != _catalog.end() && !entry->second.options.columns.empty();
+}
+
+uint32_t ArduinoMongoDB::rowCount(const String &collection)
+{
+    size_t rows = 0;
+    ArduinoMongoFS::size(docFilename(collection, "$live"), rows);
+    return rows;
+}
+
+void ArduinoMongoDB::recountCollection(const String &collection)
+{
+    CollectionInfo &info = _catalog[collection];
+    info.count = 0;
+    info.size = 0;
+
+    // Columnar collections count their live rows, their size is the size of every row
+    if(!info.options.columns.empty())
+    {
+        const String live = docFilename(collection, "$live");
+        const uint32_t rows = rowCount(collection);
+        uint8_t states[ARDUINO_MONGODB_COLUMN_CHUNK];
+        for(uint32_t row = 0; row < rows; row += sizeof(states)){
+            size_t n = rows - row < sizeof(states)? rows - row : sizeof(states);
+            if(!ArduinoMongoFS::readAt(live, row, states, n))
+                break;
+            for(size_t i = 0; i < n; i++)
+                info.count += states[i] == 1;
+        }
+        info.size = rows * rowWidth(info.options.columns);
+        return;
+    }
+
+    Dir docs = little_fs.openDir(String(_currentURI) + collection);
+    while(docs.next()){
+        info.count++;
+        info.size += docs.fileSize();
+    }
+}
+
+bool ArduinoMongoDB::writeRow(const String &document, const String &collection, const String &ID, bool &exists)
+{
+    CollectionInfo &info = _catalog[collection];
+    const std::vector<ArduinoMongoColumn> &columns = info.options.columns;
+
+    int32_t row = rowOf(ID);
+    if(row < 0)
+    {
+        logerr("Failed to create document: ID " + ID + " of columnar collection " + collection + " is not a number from 1");
+        return false;
+    }
+
+    DynamicJsonBuffer jsonBuffer(document.length());
+    JsonObject &json = jsonBuffer.parseObject(document);
+    if(!json.success())
+    {
+        logerr("Failed to create document: failed to parse JSON document");
+        return false;
+    }
+
+    // Every key needs a column
+    for(auto field: json){
+        if(String(field.key) != "_id" && findColumn(columns, field.key) == nullptr)
+        {
+            logerr("Failed to create document: collection " + collection + " has no column " + field.key);
+            return false;
+        }
+    }
+
+    // Encode the whole row before writing any of it
+    std::vector<uint8_t> cells;
+    for(const ArduinoMongoColumn &column: columns){
+        uint8_t cell[sizeof(double)];
+        if(!json.containsKey(column.name))
+            encodeMissing(column.type, cell);
+        else if(!encodeValue(column.type, json[column.name], cell))
+        {
+            logerr("Failed to create document: wrong type or out of range value for column " + column.name);
+            return false;
+        }
+        cells.insert(cells.end(), cell, cell + columnWidth(column.type));
+    }
+
+    // Counters only change when the row is new
+    const String live = docFilename(collection, "$live");
+    const uint32_t rows = rowCount(collection);
+    uint8_t state = 0;
+    exists = (uint32_t)row < rows && ArduinoMongoFS::readAt(live, row, &state, 1) && state == 1;
+    if(!exists && !beginCounterUpdate())
+        return false;
+
+    size_t offset = 0;
+    for(const ArduinoMongoColumn &column: columns){
+        size_t width = columnWidth(column.type);
+        if(!ArduinoMongoFS::writeAt(docFilename(collection, column.name), row * width, &cells[offset], width))
+            return false;
+        offset += width;
+    }
+
+    // The row becomes visible once it's marked live
+    state = 1;
+    if(!ArduinoMongoFS::writeAt(live, row, &state, 1))
+        return false;
+
+    if(!exists)
+    {
+        info.count++;
+        info.size = ((uint32_t)row < rows? rows : row + 1) * rowWidth(columns);
+        endCounterUpdate();
+    }
+    return true;
+}
+
+String ArduinoMongoDB::readRow(const String &collection, const String &ID)
+{
+    int32_t row = rowOf(ID);
+    uint8_t state = 0;
+    if(row < 0 || !ArduinoMongoFS::readAt(docFilename(collection, "$live"), row, &state, 1) || state != 1)
+        return "";
+
+    String document = "{\"_id\":\"" + ID + "\"";
+    for(const ArduinoMongoColumn &column: _catalog[collection].options.columns){
+        uint8_t cell[sizeof(double)];
+        size_t width = columnWidth(column.type);
+        if(!ArduinoMongoFS::readAt(docFilename(collection, column.name), row * width, cell, width))
+            return "";
+
+        // Missing values are left out, as in the document that was stored
+        String value = decodeValue(column.type, cell);
+        if(value.length() != 0)
+            document += ",\"" + column.name + "\":" + value;
+    }
+    document += "}";
+    return document;
+}
+
+bool ArduinoMongoDB::removeRow(const String &collection, const String &ID)
+{
+    // Rows are only marked deleted, the columns keep their size
+    const String live = docFilename(collection, "$live");
+    int32_t row = rowOf(ID);
+    uint8_t state = 0;
+    if(row < 0 || !ArduinoMongoFS::readAt(live, row, &state, 1) || state != 1 || !beginCounterUpdate())
+        return false;
+
+    state = 0;
+    if(!ArduinoMongoFS::writeAt(live, row, &state, 1))
+        return false;
+
+    _catalog[collection].count--;
+    endCounterUpdate();
+    return true;
+}
+
+bool ArduinoMongoDB::hasRow(const String &collection, const String &ID)
+{
+    int32_t row = rowOf(ID);
+    uint8_t state = 0;
+    return row >= 0 && ArduinoMongoFS::readAt(docFilename(collection, "$live"), row, &state, 1) && state == 1;
+}
+
+bool ArduinoMongoDB::openColumn(const String &collection, const String &field, ColumnScan &scan)
+{
+    auto entry = _catalog.find(collection);
+    if(!connected() || entry == _catalog.end())
+        return false;
+    const ArduinoMongoColumn *column = findColumn(entry->second.options.columns, field);
+    if(column == nullptr)
+        return false;
+
+    scan.type = column->type;
+    scan.rows = rowCount(collection);
+    if(scan.rows == 0)
+        return true;
+
+    scan.live = ArduinoMongoFS::open(docFilename(collection, "$live"), "r");
+    scan.data = ArduinoMongoFS::open(docFilename(collection, field), "r");
+    if(!scan.live || !scan.data)
+    {
+        logerr("Failed to scan column " + field + " of collection " + collection + ": failed to open its files");
+        return false;
+    }
+    return true;
+}
+
+size_t ArduinoMongoDB::readColumnChunk(ColumnScan &scan, double *values, uint8_t *present)
+{
+    if(scan.failed || scan.row >= scan.rows)
+        return 0;
+    size_t count = scan.rows - scan.row < ARDUINO_MONGODB_COLUMN_CHUNK? scan.rows - scan.row : ARDUINO_MONGODB_COLUMN_CHUNK;
+
+    // Both files are read in order, from where the previous chunk ended
+    bool success = scan.live.read(present, count) == count;
+    switch(scan.type)
+    {
+    case DBType::Int:
+        success = success && decodeColumn<int32_t>(scan.data, count, values, present);
+        break;
+    case DBType::Float:
+        success = success && decodeColumn<float>(scan.data, count, values, present);
+        break;
+    case DBType::Double:
+        success = success && decodeColumn<double>(scan.data, count, values, present);
+        break;
+    default:
+        success = success && decodeColumn<uint8_t>(scan.data, count, values, present);
+        break;
+    }
+
+    if(!success)
+    {
+        scan.failed = true;
+        return 0;
+    }
+    scan.row += count;
+    return count;
+}
+
+bool ArduinoMongoDB::aggregateColumn(const String &collection, const String &field, ArduinoMongoColumnStats &stats)
+{
+    ColumnScan scan;
+    if(!openColumn(collection, field, scan))
+        return false;
+
+    stats = ArduinoMongoColumnStats();
+    double values[ARDUINO_MONGODB_COLUMN_CHUNK];
+    uint8_t present[ARDUINO_MONGODB_COLUMN_CHUNK];
+    size_t rows;
+    while((rows = readColumnChunk(scan, values, present)) > 0){
+        for(size_t i = 0; i < rows; i++){
+            if(!present[i])
+                continue;
+            double value = values[i];
+            stats.count++;
+            stats.sum += value;
+            stats.min = value < stats.min? value : stats.min;
+            stats.max = value > stats.max? value : stats.max;
+        }
+    }
+
+    if(scan.failed)
+    {
+        logerr("Failed to aggregate column " + field + " of collection " + collection + ": only " + String(scan.row) + " rows read");
+        return false;
+    }
+    return true;
+}
+
+
+        // ------------------ EXPIRY ------------------
+/* The expiry index of a collection groups documents by expiry time into buckets of
+ * ARDUINO_MONGODB_TTL_BUCKET seconds. Each bucket is a file of "<ID> <expiresAt>" lines,
+ * so a sweep only reads the buckets that are (partly) expired.
+ * */
+bool ArduinoMongoDB::indexExpiry(const String &collection, const String &ID, uint32_t expiresAt)
+{
+    if(!connected())
+        return false;
+
+    // Append the entry, the rest of the bucket is left as is
+    const String filename = expiryFilename(collection, expiresAt / ARDUINO_MONGODB_TTL_BUCKET);
+    const String entry = ID + " " + String(expiresAt) + "\n";
+    size_t size = 0;
+    if(little_fs.exists(filename) && !ArduinoMongoFS::size(filename, size))
+        return false;
+    return ArduinoMongoFS::writeAt(filename, size, (const uint8_t *)entry.c_str(), entry.length());
+}
+
+bool ArduinoMongoDB::unindexExpiry(const String &collection, const String &ID, uint32_t expiresAt)
+{
+    if(!connected())
+        return false;
+
+    const String filename = expiryFilename(collection, expiresAt / ARDUINO_MONGODB_TTL_BUCKET);
+    if(!little_fs.exists(filename))
+        return true;
+
+    String bucket = little_fs.readFile(filename);
+    const String entry = ID + " " + String(expiresAt) + "\n";
+    int start = bucket.startsWith(entry)? 0 : bucket.indexOf("\n" + entry);
+    if(start < 0)
+        return true;
+    if(start > 0)
+        start++; // skip the newline of the previous entry
+
+    bucket.remove(start, entry.length());
+    if(bucket.length() == 0)
+        return little_fs.remove(filename);
+    return little_fs.writeFile(filename, bucket);
+}
+
+size_t ArduinoMongoDB::expireDocuments(const String &collection, uint32_t now, size_t limit)
+{
+    if(!connected())
+        return 0;
+
+    auto entry = _catalog.find(collection);
+    if(entry == _catalog.end() || entry->second.options.expireAfter == 0)
+        return 0;
+    const String path = String(_currentURI) + ARDUINO_MONGODB_TTL + "/" + collection;
+
+    // Buckets starting at or before `now` hold expired documents
+    std::vector<uint32_t> buckets;
+    Dir dir = little_fs.openDir(path);
+    while(dir.next()){
+        uint32_t bucket = dir.fileName().toInt();
+        if(bucket <= now / ARDUINO_MONGODB_TTL_BUCKET)
+            buckets.push_back(bucket);
+    }
+    std::sort(buckets.begin(), buckets.end());
+
+    size_t deleted = 0;
+    bool logged = true;
+    for(uint32_t bucket: buckets){
+        if(deleted >= limit || !logged)
+            break;
+
+        const String filename = expiryFilename(collection, bucket);
+        String entries = little_fs.readFile(filename);
+        String remaining;
+
+        // Delete expired entries up to the limit and keep the rest
+        int start = 0;
+        while(start < (int)entries.length()){
+            int end = entries.indexOf('\n', start);
+            if(end < 0)
+                end = entries.length();
+            String entry = entries.substring(start, end);
+            start = end + 1;
+
+            int sep = entry.lastIndexOf(' ');
+            if(sep <= 0)
+                continue; // drop malformed entries
+            if(logged && deleted < limit && (uint32_t)entry.substring(sep + 1).toInt() <= now)
+            {
+                // The sweep stops at a deletion that can't be recorded in the change log
+                const String ID = entry.substring(0, sep);
+                if(removeDocument(collection, ID, false))
+                {
+                    deleted++;
+                    logged = logChange("d", collection, ID, "");
+                    continue;
+                }
+
+                // A missing document was deleted explicitly, its entry is just dropped.
+                // A document that failed to be removed is retried by the next sweep.
+                if(!hasDocument(collection, ID))
+                    continue;
+            }
+            remaining += entry + "\n";
+        }
+
+        if(remaining.length() == 0)
+            little_fs.remove(filename);
+        else if(remaining.length() != entries.length())
+            little_fs.writeFile(filename, remaining);
+    }
+
+    // Counters are saved once for the whole slice
+    if(deleted > 0 && !flush())
+        logerr("Failed to save counters of collection " + collection);
+    return deleted;
+}
+
+uint32_t ArduinoMongoDB::countExpired(const String &collection, uint32_t now)
+{
+    auto entry = _catalog.find(collection);
+    if(!connected() || entry == _catalog.end() || entry->second.options.expireAfter == 0)
+        return 0;
+
+    // Only buckets starting at or before `now` are read
+    uint32_t count = 0;
+    Dir dir = little_fs.openDir(String(_currentURI) + ARDUINO_MONGODB_TTL + "/" + collection);
+    while(dir.next()){
+        uint32_t bucket = dir.fileName().toInt();
+        if(bucket > now / ARDUINO_MONGODB_TTL_BUCKET)
+            continue;
+
+        String entries = little_fs.readFile(expiryFilename(collection, bucket));
+        int start = 0;
+        while(start < (int)entries.length()){
+            int end = entries.indexOf('\n', start);
+            if(end < 0)
+                end = entries.length();
+            int sep = entries.lastIndexOf(' ', end);
+            if(sep > start && (uint32_t)entries.substring(sep + 1, end).toInt() <= now)
+                count++;
+            start = end + 1;
+        }
+    }
+    return count;
+}
+
+
+        // ------------------ SNAPSHOTS ------------------
+// Updates a CRC-32 (IEEE) with `len` bytes of `data`
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+    while(len--){
+        crc ^= *data++;
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+// Writes `len` bytes to the stream and adds them to the checksum
+static bool writeChecked(Stream &stream, const uint8_t *data, size_t len, uint32_t &crc)
+{
+    crc = crc32(crc, data, len);
+    return stream.write(data, len) == len;
+}
+
+static bool writeChecked(Stream &stream, const String &str, uint32_t &crc)
+{
+    return writeChecked(stream, (const uint8_t *)str.c_str(), str.length(), crc);
+}
+
+// Reads exactly `len` bytes from the stream and adds them to the checksum
+static bool readChecked(Stream &stream, uint8_t *data, size_t len, uint32_t &crc)
+{
+    if(stream.readBytes(data, len) != len)
+        return false;
+    crc = crc32(crc, data, len);
+    return true;
+}
+
+bool ArduinoMongoDB::exportFiles(Stream &stream, const String &dir, uint32_t &crc)
+{
+    const String path = String(_currentURI) + dir;
+    uint8_t buffer[ARDUINO_MONGODB_SNAPSHOT_CHUNK];
+
+    Dir entries = little_fs.openDir(path);
+    while(entries.next()){
+        File file = ArduinoMongoFS::open(path + "/" + entries.fileName(), "r");
+        if(!file)
+        {
+            logerr("Failed to export snapshot: failed to read " + dir + "/" + entries.fileName());
+            return false;
+        }
+
+        size_t remaining = file.size();
+        bool success = writeChecked(stream, "F " + dir + "/" + entries.fileName() + " " + String(remaining) + "\n", crc);
+        while(success && remaining > 0){
+            size_t n = file.read(buffer, remaining < sizeof(buffer)? remaining : sizeof(buffer));
+            success = n > 0 && writeChecked(stream, buffer, n, crc);
+            remaining -= n;
+        }
+        file.close();
+
+        if(!success)
+        {
+            logerr("Failed to export snapshot: failed to copy " + dir + "/" + entries.fileName());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ArduinoMongoDB::exportSnapshot(Stream &stream)
+{
+    if(!connected())
+        return false;
+
+    uint32_t crc = 0;
+    if(!writeChecked(stream, String(ARDUINO_MONGODB_SNAPSHOT) + "\n", crc))
+        return false;
+
+    for(auto &entry: _catalog){
+        // The catalog entry comes first, so that import can create the collection
+        DynamicJsonBuffer jsonBuffer(JSON_OBJECT_SIZE(8));
+        JsonObject &json = jsonBuffer.createObject();
+        writeInfo(entry.second, json);
+        String info;
+        json.printTo(info);
+        if(!writeChecked(stream, "C " + entry.first + " " + String(info.length()) + "\n" + info, crc))
+            return false;
+
+        // Document or column files, then the expiry index
+        if(!exportFiles(stream, entry.first, crc))
+            return false;
+        if(entry.second.options.expireAfter > 0 &&
+           !exportFiles(stream, String(ARDUINO_MONGODB_TTL) + "/" + entry.first, crc))
+            return false;
+    }
+
+    String end = "E " + String(crc) + "\n";
+    return stream.write((const uint8_t *)end.c_str(), end.length()) == end.length();
+}
+
+/* Moves directory `live` to `away`, if it exists, then directory `into` to `live`, if it
+ * exists. On failure everything is moved back.
+ * */
+static bool swapDirectory(const String &live, const String &away, const String &into)
+{
+    const bool moved = little_fs.exists(live);
+    if(moved && !ArduinoMongoFS::rename(live, away))
+        return false;
+    if(little_fs.exists(into) && !ArduinoMongoFS::rename(into, live))
+    {
+        if(moved)
+            ArduinoMongoFS::rename(away, live);
+        return false;
+    }
+    return true;
+}
+
+bool ArduinoMongoDB::stageSnapshot(Stream &stream, const String &staged, std::map<String, CollectionInfo> &imported)
+{
+    uint32_t crc = 0;
+    String line = stream.readStringUntil('\n');
+    if(line != ARDUINO_MONGODB_SNAPSHOT)
+    {
+        logerr("Failed to import snapshot: unknown format");
+        return false;
+    }
+    crc = crc32(crc, (const uint8_t *)(line + "\n").c_str(), line.length() + 1);
+
+    uint8_t buffer[ARDUINO_MONGODB_SNAPSHOT_CHUNK];
+    for(;;){
+        line = stream.readStringUntil('\n');
+        if(line.startsWith("E "))
+            break;
+        crc = crc32(crc, (const uint8_t *)(line + "\n").c_str(), line.length() + 1);
+
+        // "<type> <name> <length>": names may contain spaces, the length can't
+        int sep = line.lastIndexOf(' ');
+        if(line.length() < 2 || line[1] != ' ' || sep <= 2)
+        {
+            logerr("Failed to import snapshot: corrupt record");
+            return false;
+        }
+        const String name = line.substring(2, sep);
+        size_t remaining = line.substring(sep + 1).toInt();
+
+        if(line[0] == 'C')
+        {
+            String content;
+            while(remaining > 0){
+                size_t n = remaining < sizeof(buffer)? remaining : sizeof(buffer);
+                if(!readChecked(stream, buffer, n, crc))
+                {
+                    logerr("Failed to import snapshot: truncated record");
+                    return false;
+                }
+                for(size_t i = 0; i < n; i++)
+                    content += (char)buffer[i];
+                remaining -= n;
+            }
+
+            DynamicJsonBuffer jsonBuffer(content.length());
+            JsonObject &json = jsonBuffer.parseObject(content);
+            if(!json.success() || name.startsWith("$") || name.indexOf('/') >= 0)
+            {
+                logerr("Failed to import snapshot: corrupt collection " + name);
+                return false;
+            }
+
+            // Staged directories of the collection's files
+            CollectionInfo info = readInfo(json);
+            const String path = staged + name;
+            const String ttl = staged + ARDUINO_MONGODB_TTL + "/" + name;
+            if((!little_fs.exists(path) && !little_fs.mkdir(path)) ||
+               (info.options.expireAfter > 0 && !little_fs.exists(ttl) && !little_fs.mkdir(ttl)))
+            {
+                logerr("Failed to import snapshot: failed to create collection " + name);
+                return false;
+            }
+            imported[name] = info;
+        }
+        else if(line[0] == 'F')
+        {
+            // Only files of the collections in this snapshot are written
+            String relative = name.startsWith(String(ARDUINO_MONGODB_TTL) + "/")? name.substring(strlen(ARDUINO_MONGODB_TTL) + 1) : name;
+            int slash = relative.indexOf('/');
+            if(slash <= 0 || relative.indexOf('/', slash + 1) >= 0 || relative.indexOf("..") >= 0 ||
+               imported.find(relative.substring(0, slash)) == imported.end())
+            {
+                logerr("Failed to import snapshot: unexpected file " + name);
+                return false;
+            }
+
+            File file = ArduinoMongoFS::open(staged + name, "w");
+            bool success = (bool)file;
+            while(success && remaining > 0){
+                size_t n = remaining < sizeof(buffer)? remaining : sizeof(buffer);
+                success = readChecked(stream, buffer, n, crc) && file.write(buffer, n) == n;
+                remaining -= n;
+            }
+            if(file)
+                file.close();
+
+            if(!success)
+            {
+                logerr("Failed to import snapshot: failed to write " + name);
+                return false;
+            }
+        }
+        else
+        {
+            logerr("Failed to import snapshot: corrupt record");
+            return false;
+        }
+    }
+
+    if(strtoul(line.c_str() + 2, nullptr, 10) != crc)
+    {
+        logerr("Failed to import snapshot: checksum mismatch");
+        return false;
+    }
+    return true;
+}
+
+bool ArduinoMongoDB::applySnapshot(const String &staging, const std::map<String, CollectionInfo> &imported)
+{
+    // Directories of each collection: its documents or columns, and its expiry index
+    std::vector<String> dirs;
+    for(auto &entry: imported){
+        dirs.push_back(entry.first);
+        dirs.push_back(String(ARDUINO_MONGODB_TTL) + "/" + entry.first);
+    }
+
+    const String ttl = String(_currentURI) + ARDUINO_MONGODB_TTL;
+    if((!little_fs.exists(ttl) && !little_fs.mkdir(ttl)) || !beginCounterUpdate())
+    {
+        logerr("Failed to import snapshot: failed to prepare database");
+        return false;
+    }
+
+    // Swap the current directories with the staged ones, the replaced ones move to `old`
+    size_t swapped = 0;
+    for(; swapped < dirs.size(); swapped++){
+        if(!swapDirectory(String(_currentURI) + dirs[swapped], staging + "/old/" + dirs[swapped],
+                          staging + "/new/" + dirs[swapped]))
+            break;
+    }
+
+    // Bulk load: the catalog entries carry the counters, nothing is scanned
+    const std::map<String, CollectionInfo> catalog = _catalog;
+    const std::map<String, ArduinoMongoCodec> codecs = _codecs;
+    if(swapped == dirs.size())
+    {
+        for(auto &entry: imported){
+            _catalog[entry.first] = entry.second;
+            if(!entry.second.options.columns.empty())
+                _catalog[entry.first].nextID = rowCount(entry.first) + 1;
+            if(!entry.second.options.dictionary.empty())
+                _codecs[entry.first] = ArduinoMongoCodec(entry.second.options.dictionary);
+            else
+                _codecs.erase(entry.first);
+        }
+        if(saveCatalog())
+        {
+            // Imported documents aren't logged one by one: each collection is recorded as
+            // dropped and imported, for readers to copy it again. The import stands either way,
+            // but a change missing from the log must be reported.
+            for(auto &entry: imported){
+                const String ns = jsonString(entry.first);
+                if(!logChange("c", entry.first, "", "{\"drop\":" + ns + "}") ||
+                   !logChange("c", entry.first, "", "{\"import\":" + ns + "}"))
+                {
+                    logerr("Failed to record import of collection " + entry.first);
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    // Put the replaced directories and the catalog back
+    logerr("Failed to import snapshot: failed to replace collections");
+    while(swapped-- > 0)
+        swapDirectory(String(_currentURI) + dirs[swapped], staging + "/new/" + dirs[swapped],
+                      staging + "/old/" + dirs[swapped]);
+    _catalog = catalog;
+    _codecs = codecs;
+    return false;
+}
+
+bool ArduinoMongoDB::importSnapshot(Stream &stream)
+{
+    if(!connected())
+        return false;
+
+    // Files are streamed to `<staging>/new` and the database is only changed once the
+    // checksum matched. A staging directory left by an interrupted import is discarded.
+    const String staging = String(_currentURI) + ARDUINO_MONGODB_IMPORT;
+    if(little_fs.exists(staging))
+    {
+        removeFiles(staging);
+        little_fs.rmdir(staging);
+    }
+
+    const String dirs[] = {staging, staging + "/new", staging + "/new/" + ARDUINO_MONGODB_TTL,
+                           staging + "/old", staging + "/old/" + ARDUINO_MONGODB_TTL};
+    bool success = true;
+    for(const String &dir: dirs)
+        success = success && little_fs.mkdir(dir);
+    if(!success)
+        logerr("Failed to import snapshot: failed to create staging directory");
+
+    std::map<String, CollectionInfo> imported;
+    success = success && stageSnapshot(stream, staging + "/new/", imported) && applySnapshot(staging, imported);
+
+    // Staged files of a failed import, or the replaced collections
+    removeFiles(staging);
+    little_fs.rmdir(staging);
+    return success;
+}
+
+
+        // ------------------ CHANGE LOG ------------------
+String ArduinoMongoDB::changeFilename(uint32_t seq)
+{
+    String name = String(seq);
+    while(name.length() < 10)
+        name = "0" + name;
+    return String(_currentURI) + ARDUINO_MONGODB_CHANGELOG + "/" + name;
+}
+
+void ArduinoMongoDB::loadChangeLog()
+{
+    _firstChange = 1;
+    _lastChange = 0;
+    _changeLogEnabled = little_fs.exists(String(_currentURI) + ARDUINO_MONGODB_CHANGELOG);
+    if(!_changeLogEnabled)
+        return;
+
+    // Recover the retained range from the entry names, once per connection
+    bool empty = true;
+    Dir dir = little_fs.openDir(String(_currentURI) + ARDUINO_MONGODB_CHANGELOG);
+    while(dir.next()){
+        uint32_t seq = dir.fileName().toInt();
+        if(empty || seq < _firstChange)
+            _firstChange = seq;
+        if(empty || seq > _lastChange)
+            _lastChange = seq;
+        empty = false;
+    }
+}
+
+bool ArduinoMongoDB::logChange(const char *op, const String &collection, const String &ID, const String &document)
+{
+    if(!_changeLogEnabled)
+        return true;
+
+    // Documents that aren't JSON objects are recorded as strings, so that every entry parses
+    String o = "null";
+    if(document.length() != 0)
+    {
+        DynamicJsonBuffer jsonBuffer(document.length());
+        o = jsonBuffer.parseObject(document).success()? document : jsonString(document);
+    }
+
+    uint32_t seq = _lastChange + 1;
+    String entry = "{\"seq\":" + String(seq) + ",\"op\":\"" + op + "\",\"ns\":" + jsonString(collection) +
+                   ",\"_id\":" + jsonString(ID) + ",\"o\":" + o + "}";
+    if(!little_fs.writeFile(changeFilename(seq), entry))
+    {
+        logerr("Failed to record change " + String(seq) + " in the change log");
+        return false;
+    }
+
+    if(_lastChange < _firstChange)
+        _firstChange = seq;
+    _lastChange = seq;
+    return true;
+}
+
+bool ArduinoMongoDB::enableChangeLog(bool enabled)
+{
+    if(!connected())
+        return false;
+
+    const String path = String(_currentURI) + ARDUINO_MONGODB_CHANGELOG;
+    if(enabled)
+    {
+        if(!little_fs.exists(path) && !little_fs.mkdir(path))
+            return false;
+        _changeLogEnabled = true;
+        return true;
+    }
+
+    if(!_changeLogEnabled)
+        return true;
+
+    // Discard all entries, then the log itself
+    for(uint32_t seq = _firstChange; seq <= _lastChange; seq++)
+        little_fs.remove(changeFilename(seq));
+    _changeLogEnabled = false;
+    _firstChange = 1;
+    _lastChange = 0;
+    return little_fs.rmdir(path);
+}
+
+bool ArduinoMongoDB::truncateChanges(uint32_t upTo)
+{
+    if(!connected() || !_changeLogEnabled)
+        return false;
+
+    // Keep the latest entry: it carries the sequence number across restarts
+    if(_lastChange == 0)
+        return true;
+    if(upTo >= _lastChange)
+        upTo = _lastChange - 1;
+
+    bool success = true;
+    for(; _firstChange <= upTo; _firstChange++){
+        if(!little_fs.remove(changeFilename(_firstChange)))
+        {
+            logerr("Failed to truncate change " + String(_firstChange));
+            success = false;
+            break;
+        }
+    }
+    return success;
 }
\ No newline at end of file
@@ -3,13 +3,164 @@
 
 #include "littlefs_filesystem.h"
 #include "arduino_utilities.h"
+#include "arduino_mongo_queue.h"
+#include "arduino_mongo_codec.h"
+#include "arduino_mongo_fs.h"
+#include "schema.h"
+#include <map>
+#include <vector>
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#endif
+
+// Parallel scans need a second core: single-core ESP32 variants (S2, C3, ...) scan sequentially
+#if defined(ESP32) && !defined(CONFIG_FREERTOS_UNICORE) && portNUM_PROCESSORS > 1
+#define ARDUINO_MONGODB_PARALLEL_SCAN
+#endif
 
 // File IO interface for the DB
 #define ARDUINO_MONGODB_PATH "/AMDB"
+
+// Catalog of the collections of a database, kept in two slots: "$catalog.0" and "$catalog.1"
+#define ARDUINO_MONGODB_CATALOG "$catalog"
+
+// Directory of the change log inside a database. `$` can't start a collection name.
+#define ARDUINO_MONGODB_CHANGELOG "$oplog"
+
+// Directory of the expiry indexes inside a database, one sub directory per collection
+#define ARDUINO_MONGODB_TTL "$ttl"
+
+// Counter updates kept in memory before the catalog is saved (see ArduinoMongoDB::flush)
+#ifndef ARDUINO_MONGODB_COUNTER_FLUSH
+#define ARDUINO_MONGODB_COUNTER_FLUSH 16
+#endif
+
+// Document IDs reserved per catalog write (see ArduinoMongoDB::nextID)
+#ifndef ARDUINO_MONGODB_ID_BLOCK
+#define ARDUINO_MONGODB_ID_BLOCK 16
+#endif
+
+// Expiry index tuning (see ArduinoMongoDB::expireDocuments)
+#ifndef ARDUINO_MONGODB_TTL_BUCKET
+#define ARDUINO_MONGODB_TTL_BUCKET 60 // seconds of expiry times grouped in one index file
+#endif
+#ifndef ARDUINO_MONGODB_TTL_SLICE
+#define ARDUINO_MONGODB_TTL_SLICE 16 // documents deleted per call by default
+#endif
+
+// Rows read at once by column scans (see ArduinoMongoDB::scanColumn)
+#ifndef ARDUINO_MONGODB_COLUMN_CHUNK
+#define ARDUINO_MONGODB_COLUMN_CHUNK 64
+#endif
+
+// Staging directory of a snapshot import inside a database
+#define ARDUINO_MONGODB_IMPORT "$import"
+
+// First line of a snapshot (see ArduinoMongoDB::exportSnapshot)
+#define ARDUINO_MONGODB_SNAPSHOT "AMDB-SNAPSHOT 1"
+#ifndef ARDUINO_MONGODB_SNAPSHOT_CHUNK
+#define ARDUINO_MONGODB_SNAPSHOT_CHUNK 128 // bytes copied at once between files and the stream
+#endif
+
+// Parallel scan tuning (see ArduinoMongoDB::findDocumentsParallel)
+#ifndef ARDUINO_MONGODB_SCAN_QUEUE
+#define ARDUINO_MONGODB_SCAN_QUEUE 8 // documents buffered between reader and parser, power of two
+#endif
+#ifndef ARDUINO_MONGODB_SCAN_CORE
+#define ARDUINO_MONGODB_SCAN_CORE 0 // core the flash reader runs on; loop() runs on core 1
+#endif
+#ifndef ARDUINO_MONGODB_SCAN_STACK
+#define ARDUINO_MONGODB_SCAN_STACK 4096
+#endif
+
+/* A typed column of a columnar collection. Values are stored fixed width:
+ * Int as int32_t, Float as float, Double as double and Boolean as uint8_t.
+ * Int values range from -2147483647 to 2147483647: INT32_MIN marks a missing value.
+ * */
+struct ArduinoMongoColumn
+{
+    String name;
+    DBType type;
+};
+
+/* Storage options of a collection, applied when the collection is created.
+ * - `compressed`: documents are stored encoded with ArduinoMongoCodec
+ * - `dictionary`: keys encoded as a single byte, usually the schema's field names. Once a
+ *   collection has documents, new keys are only appended to its dictionary
+ * - `expireAfter`: seconds documents are kept for, 0 to keep them forever. Documents are
+ *   added to the expiry index with ArduinoMongoDB::indexExpiry
+ * - `expiryField`: field documents expire `expireAfter` seconds after. Deleting a document
+ *   then also removes its expiry index entry; without it, call ArduinoMongoDB::unindexExpiry
+ *   before deleting a document
+ * - `columns`: if not empty, documents are stored as rows of these columns instead of
+ *   one file each. Document IDs must then be numbers from 1, as given by nextID.
+ * */
+struct ArduinoMongoCollectionOptions
+{
+    bool compressed = false;
+    std::vector<String> dictionary;
+    uint32_t expireAfter = 0;
+    String expiryField;
+    std::vector<ArduinoMongoColumn> columns;
+};
+
+/* Aggregates of the values of a column, see ArduinoMongoDB::aggregateColumn.
+ * Missing values aren't counted.
+ * */
+struct ArduinoMongoColumnStats
+{
+    uint32_t count = 0;
+    double sum = 0;
+    double min = infinity();
+    double max = -infinity();
+};
+
 class ArduinoMongoDB{
     private:
         static String _currentURI;
 
+        /* Catalog entry of a collection:
+         * - `options`: storage options the collection was created with
+         * - `nextID`: next document ID handed out by ArduinoMongoDB::nextID
+         * - `reservedID`: end of the block of IDs reserved in the saved catalog, which stores it
+         *   as the collection's `nextID`
+         * - `count`: number of documents, maintained by every insert and delete
+         * - `size`: bytes used by the document files
+         * */
+        struct CollectionInfo
+        {
+            ArduinoMongoCollectionOptions options;
+            uint32_t nextID = 1;
+            uint32_t reservedID = 1;
+            uint32_t count = 0;
+            uint32_t size = 0;
+        };
+
+        // Collections of the current database, loaded from the catalog at connect
+        static std::map<String, CollectionInfo> _catalog;
+        static uint32_t _catalogGeneration;
+
+        /* Counters are saved in batches. Before the first update after a save, the catalog is
+         * saved marked as not counted, so that a restart before the next save recounts them.
+         * - `_countersStale`: the saved catalog is marked as not counted
+         * - `_unsavedCounters`: counter updates since the catalog was last saved
+         * */
+        static bool _countersStale;
+        static uint32_t _unsavedCounters;
+
+        // Codecs of the collections with a dictionary in the current database. A collection
+        // that stopped compressing keeps its codec to read the documents stored encoded.
+        static std::map<String, ArduinoMongoCodec> _codecs;
+
+        // Change log state of the current database: sequence numbers of the oldest
+        // retained and of the newest change. The log is empty when first > last.
+        static bool _changeLogEnabled;
+        static uint32_t _firstChange;
+        static uint32_t _lastChange;
+
         /** 
          * docFilename(collection, ID)
          * Returns the filename of document with id `ID` inside the collection `collection`
@@ -19,6 +170,202 @@ class ArduinoMongoDB{
             return String(_currentURI) + collection + "/" + ID;
         }
 
+        /* State shared between the reader task and the parsing task of a parallel scan.
+         * The reader is the only producer and the caller the only consumer of `queue`.
+         * The reader only uses the path and codec copied here, never the catalog.
+         * - `items` counts the documents in `queue`, plus one once the listing is done
+         * - `space` counts the free slots of `queue`
+         * */
+        struct ScanContext
+        {
+            String path;
+            ArduinoMongoCodec codec;
+            bool hasCodec = false;
+            ArduinoMongoQueue<String, ARDUINO_MONGODB_SCAN_QUEUE> queue;
+#if defined(ARDUINO_MONGODB_PARALLEL_SCAN)
+            SemaphoreHandle_t items = nullptr;
+            SemaphoreHandle_t space = nullptr;
+            TaskHandle_t consumer = nullptr;
+#endif
+        };
+
+        // Reader task body of a parallel scan. `arg` is a ScanContext.
+        static void scanReader(void *arg);
+
+        /** 
+         * changeFilename(seq)
+         * Returns the filename of change `seq`, zero padded so that entries list in order
+         * */
+        static String changeFilename(uint32_t seq);
+
+        /** 
+         * expiryFilename(collection, bucket)
+         * Returns the filename of the expiry index bucket `bucket` of the collection `collection`
+         * */
+        static String expiryFilename(const String& collection, uint32_t bucket) 
+        {
+            return String(_currentURI) + ARDUINO_MONGODB_TTL + "/" + collection + "/" + String(bucket);
+        }
+
+        /** 
+         * catalogFilename(generation)
+         * Returns the filename of the catalog slot that generation `generation` is written to
+         * */
+        static String catalogFilename(uint32_t generation) 
+        {
+            return String(_currentURI) + ARDUINO_MONGODB_CATALOG + "." + String(generation % 2);
+        }
+
+        // Loads the catalog of the current database, rebuilding it if there is none
+        static void loadCatalog();
+
+        // Reads and writes the catalog entry of a collection as JSON
+        static CollectionInfo readInfo(JsonObject &entry);
+        static void writeInfo(const CollectionInfo &info, JsonObject &entry);
+
+        // Builds the catalog of a database created before catalogs existed
+        static void rebuildCatalog();
+
+        // Recounts the documents and bytes of a collection from its files
+        static void recountCollection(const String&);
+
+        /* Writes the catalog to the slot not holding the current generation, so that
+         * an interrupted write leaves the previous catalog intact.
+         * :param counted: false to mark the saved counters as possibly stale.
+         * */
+        static bool saveCatalog(bool counted = true);
+
+        /* Called before and after a write that changes a collection's counters.
+         * `beginCounterUpdate` returns false if the catalog can't be marked as not counted.
+         * */
+        static bool beginCounterUpdate();
+        static void endCounterUpdate();
+
+        /**
+         * removeDocument(collection, ID, unindex)
+         * Deletes a document and updates the collection's counters, without saving the catalog
+         * or recording a change.
+         * :param unindex: Also remove the document's expiry index entry, if the collection has
+         *                 an `expiryField`. The expiry sweep drops the entries itself.
+         * */
+        static bool removeDocument(const String&, const String&, bool unindex = true);
+
+        // Returns true if the document is stored, so that a failed removal can be told from a missing document
+        static bool hasDocument(const String&, const String&);
+
+        /**
+         * removeDocuments(collection, IDs)
+         * Deletes documents, records them in the change log and saves the collection's counters
+         * once. Stops at the first deletion the change log fails to record.
+         * :returns: The number of documents removed.
+         * */
+        static size_t removeDocuments(const String&, const std::vector<String>&);
+
+        /**
+         * clearCollection(collection)
+         * Removes all documents and expiry index entries of a collection and resets its
+         * counters, without saving the catalog or recording a change. If some files can't
+         * be removed, the counters are recounted from what's left.
+         * :returns: The number of documents removed.
+         * */
+        static size_t clearCollection(const String&);
+
+        /**
+         * removeCollection(collection, removed)
+         * Drops a collection, see dropCollection, and sets `removed` to the number of
+         * documents removed.
+         * :returns: false if the collection is left in place or its drop isn't recorded in
+         *           the change log.
+         * */
+        static bool removeCollection(const String&, size_t &removed);
+
+        // ------------------ COLUMNAR STORAGE ------------------
+        /* A columnar collection keeps one file per column in its directory, named after
+         * the field, and a `$live` file with one byte per row: 1 if the row holds a document.
+         * Document ID `n` is row `n - 1`.
+         * */
+
+        // Returns true if the collection stores documents in columns
+        static bool isColumnar(const String&);
+
+        // Returns the number of rows of a columnar collection, deleted ones included
+        static uint32_t rowCount(const String&);
+
+        // Columnar counterparts of createDocument, readDocument, removeDocument and hasDocument
+        static bool writeRow(const String&, const String&, const String&, bool &exists);
+        static String readRow(const String&, const String&);
+        static bool removeRow(const String&, const String&);
+        static bool hasRow(const String&, const String&);
+
+        /* Column scan in progress: the `$live` and column files stay open across chunks and
+         * the row count is read once, rows added during the scan aren't read.
+         * - `row`: next row to read
+         * - `failed`: set when a file was shorter than the row count, which ends the scan
+         * The files are closed when the scan goes out of scope.
+         * */
+        struct ColumnScan
+        {
+            File live;
+            File data;
+            DBType type = DBType::Int;
+            uint32_t rows = 0;
+            uint32_t row = 0;
+            bool failed = false;
+
+            ~ColumnScan()
+            {
+                if(live)
+                    live.close();
+                if(data)
+                    data.close();
+            }
+        };
+
+        // Opens a field of a columnar collection for a scan. Returns false if the collection
+        // isn't columnar, has no such field or its files can't be opened.
+        static bool openColumn(const String&, const String&, ColumnScan&);
+
+        /**
+         * readColumnChunk(scan, values, present)
+         * Reads the next ARDUINO_MONGODB_COLUMN_CHUNK values at most of a column scan.
+         * `present[i]` is set to 0 for deleted rows and missing values.
+         * :returns: The number of rows read, 0 at the end of the column or on a short read,
+         *           which sets `scan.failed`.
+         * */
+        static size_t readColumnChunk(ColumnScan&, double *values, uint8_t *present);
+
+        /**
+         * exportFiles(stream, dir, crc)
+         * Writes a snapshot record for every file in `dir`, relative to the database folder.
+         * */
+        static bool exportFiles(Stream&, const String&, uint32_t &crc);
+
+        /**
+         * stageSnapshot(stream, staged, imported)
+         * Writes the files of a snapshot under directory `staged` and collects its catalog entries
+         * in `imported`, without changing the database.
+         * :returns: false if the snapshot is corrupt, its checksum doesn't match or a file can't be written.
+         * */
+        static bool stageSnapshot(Stream&, const String&, std::map<String, CollectionInfo>&);
+
+        /**
+         * applySnapshot(staging, imported)
+         * Replaces the directories of the imported collections with the ones staged in
+         * `<staging>/new`, moving the current ones to `<staging>/old`, then saves the catalog.
+         * On failure the directories and the catalog are put back.
+         * */
+        static bool applySnapshot(const String&, const std::map<String, CollectionInfo>&);
+
+        // Loads the change log state of the current database
+        static void loadChangeLog();
+
+        /**
+         * logChange(op, collection, ID, document)
+         * Appends a change to the change log if it is enabled.
+         * :param op: "i" for insert, "u" for update, "d" for delete.
+         * */
+        static bool logChange(const char *op, const String &collection, const String &ID, const String &document);
+
     public:
         ArduinoMongoDB();
 
@@ -32,14 +379,57 @@ class ArduinoMongoDB{
         // Returns the current database URI.
         static String currentDatabase();
 
+        /**
+         * flush()
+         * Saves the document counters that are still only in memory. Counters are saved every
+         * ARDUINO_MONGODB_COUNTER_FLUSH updates: call this before a planned power off, otherwise
+         * the next connect recounts the documents of every collection.
+         * */
+        static bool flush();
+
 
         // ------------------ COLLECTION OPERATIONS ------------------
         // Create a new collection in the current database.
         static bool createCollection(const String&);
 
-        // Delete a collection from the current database.
+        /**
+         * createCollection(collection, options)
+         * Create a new collection in the current database and apply its storage options.
+         * :param collection: The collection to create.
+         * :param options: Storage options of the collection.
+         * */
+        static bool createCollection(const String&, const ArduinoMongoCollectionOptions&);
+
+        // Delete a collection from the current database, with all of its documents.
+        // Returns false if the drop fails or isn't recorded in the change log.
         static bool deleteCollection(const String&);
 
+        /**
+         * dropCollection(collection)
+         * Deletes a collection with all of its documents and indexes. A drop the change log
+         * fails to record is logged as an error.
+         * :returns: The number of documents removed.
+         * */
+        static size_t dropCollection(const String&);
+
+        /**
+         * truncateCollection(collection)
+         * Deletes all documents of a collection, keeping the collection and its options.
+         * Columnar collections only remove a file per column. A truncation the change log
+         * fails to record is logged as an error.
+         * :returns: The number of documents removed, fewer if some can't be removed.
+         * */
+        static size_t truncateCollection(const String&);
+
+        // Returns true if the collection exists in the current database.
+        static bool hasCollection(const String&);
+
+        // Returns the number of documents in a collection, without reading them.
+        static uint32_t countDocuments(const String&);
+
+        // Returns the bytes of flash used by the documents of a collection, without reading them.
+        static uint32_t estimatedSize(const String&);
+
 
         // ------------------ DOCUMENT OPERATIONS ------------------
         /**
@@ -48,6 +438,8 @@ class ArduinoMongoDB{
          * :param document: The document String to create.
          * :param collection: The collection to create the document in.
          * :param ID: The ID of the document.
+         * :returns: false if the document can't be written, or was written but the change log
+         *           failed to record it.
          * */
         static bool createDocument(const String&, const String&, const String&);
 
@@ -68,6 +460,39 @@ class ArduinoMongoDB{
         template <typename T>
         static void findDocuments(const String&, T);
 
+        /**
+         * scanColumn(collection, field, callback)
+         * Calls `callback(ID, value)` with each value of a field of a columnar collection.
+         * Only that field's column is read, in chunks of ARDUINO_MONGODB_COLUMN_CHUNK rows.
+         * :param collection: The columnar collection to scan.
+         * :param field: The field to read.
+         * :param callback: The callback function, called with a uint32_t ID and a double value.
+         * :returns: The number of values read. A scan ended by a read error is logged.
+         * */
+        template <typename T>
+        static uint32_t scanColumn(const String&, const String&, T);
+
+        /**
+         * aggregateColumn(collection, field, stats)
+         * Computes the count, sum, min and max of a field of a columnar collection, reading
+         * only that field's column.
+         * :returns: false if the collection isn't columnar, has no such field or a read fails.
+         * */
+        static bool aggregateColumn(const String&, const String&, ArduinoMongoColumnStats&);
+
+        /**
+         * findDocumentsParallel(collection, callback)
+         * Same as findDocuments, but on dual-core targets the files are read from flash by a
+         * task pinned to ARDUINO_MONGODB_SCAN_CORE while the calling task parses them and runs
+         * the callback. Falls back to findDocuments where a second core is not available.
+         * The callback may use the database, but must not add or remove documents of the
+         * collection being scanned.
+         * :param collection: The collection to get documents from.
+         * :param callback: The callback function to use to find documents.
+         * */
+        template <typename T>
+        static void findDocumentsParallel(const String&, T);
+
         /**
          * updateDocument(document, collection, ID)
          * This is an alias for createDocument.
@@ -83,10 +508,333 @@ class ArduinoMongoDB{
          * Deletes the document with the specified ID from the specified collection.
          * :param collection: The collection to delete the document from.
          * :param ID: The ID of the document to delete.
+         * :returns: false if the document can't be deleted, or was deleted but the change log
+         *           failed to record it.
          * */
         static bool deleteDocument(const String&, const String&);
 
+        /**
+         * deleteMany(collection, filter)
+         * Deletes all documents of a collection that match the filter.
+         * :param collection: The collection to delete documents from.
+         * :param filter: Called with the JSON String of each document, returns true to delete it.
+         * :returns: The number of documents removed.
+         * */
+        template <typename T>
+        static size_t deleteMany(const String&, T);
+
+        /**
+         * deleteMany(collection, field, predicate)
+         * Deletes documents of a columnar collection by the value of one field. Only that
+         * field's column is read.
+         * :param collection: The columnar collection to delete documents from.
+         * :param field: The field to test.
+         * :param predicate: Called with the field's value as a double, returns true to delete the document.
+         * :returns: The number of documents removed.
+         * */
+        template <typename T>
+        static size_t deleteMany(const String&, const String&, T);
+
+        /**
+         * nextID(collection)
+         * Returns a new document ID for the collection, IDs increase in insertion order.
+         * IDs are reserved ARDUINO_MONGODB_ID_BLOCK at a time, so after a restart numbering
+         * resumes after the last reserved block. Columnar collections resume after their last row.
+         * Returns an empty string if the collection doesn't exist.
+         * */
+        static String nextID(const String&);
+
+
+        // ------------------ EXPIRY ------------------
+        /**
+         * indexExpiry(collection, ID, expiresAt)
+         * Adds a document to its collection's expiry index. Only for collections created with
+         * `expireAfter` set.
+         * :param collection: The collection of the document.
+         * :param ID: The ID of the document.
+         * :param expiresAt: Time the document expires at, in the same unit as `now` in expireDocuments.
+         * */
+        static bool indexExpiry(const String&, const String&, uint32_t);
+
+        /**
+         * unindexExpiry(collection, ID, expiresAt)
+         * Removes a document from its collection's expiry index, e.g. before its expiry time is changed.
+         * */
+        static bool unindexExpiry(const String&, const String&, uint32_t);
+
+        /**
+         * expireDocuments(collection, now, limit)
+         * Deletes up to `limit` documents that expired at or before `now`, oldest first.
+         * Only the expired part of the expiry index is read and no document is opened, so
+         * this can run in small slices from loop().
+         * :returns: The number of documents deleted.
+         * */
+        static size_t expireDocuments(const String&, uint32_t, size_t limit = ARDUINO_MONGODB_TTL_SLICE);
+
+        /**
+         * countExpired(collection, now)
+         * Returns the number of documents that expired at or before `now`, counted from the
+         * expiry index without opening any document.
+         * */
+        static uint32_t countExpired(const String&, uint32_t);
+
+
+        // ------------------ SNAPSHOTS ------------------
+        /**
+         * exportSnapshot(stream)
+         * Writes every collection of the current database, with its documents and indexes, to
+         * `stream` as one sequential snapshot ending with a CRC-32 of its content. Files are copied
+         * ARDUINO_MONGODB_SNAPSHOT_CHUNK bytes at a time. The change log is not included.
+         * Snapshot format, one record per collection followed by one record per file:
+         *   AMDB-SNAPSHOT 1\n
+         *   C <collection> <length>\n<catalog entry JSON>
+         *   F <path> <length>\n<file content>
+         *   E <crc>\n
+         * :returns: false if a file can't be read or the stream can't be written.
+         * */
+        static bool exportSnapshot(Stream&);
+
+        /**
+         * importSnapshot(stream)
+         * Restores the collections of a snapshot into the current database. Collections with the
+         * same name are replaced. Files are written as stored and documents aren't validated again.
+         * The snapshot is first streamed to a staging directory: the database is only changed once
+         * the checksum matches, and left as it was if the import fails.
+         * Each imported collection is recorded in the change log as a drop followed by an
+         * import, see readChanges: the documents it held before aren't listed.
+         * :returns: false if the snapshot is corrupt or can't be written, or if the change log
+         *           fails to record the import, which is kept.
+         * */
+        static bool importSnapshot(Stream&);
+
+
+        // ------------------ CHANGE LOG ------------------
+        /**
+         * enableChangeLog(enabled)
+         * Starts or stops recording inserts, updates and deletes of the current database in an
+         * append-only change log. The setting is persisted with the database.
+         * Disabling the change log discards all of its entries.
+         * */
+        static bool enableChangeLog(bool enabled = true);
+
+        // Returns true if the current database records a change log.
+        static bool changeLogEnabled() {return _changeLogEnabled;}
+
+        // Returns the sequence number of the latest change, 0 if nothing was recorded yet.
+        static uint32_t lastChange() {return _lastChange;}
+
+        /**
+         * readChanges(since, callback, limit)
+         * Calls `callback` with each change entry recorded after sequence number `since`, oldest
+         * first. An entry is a JSON String: {"seq":1,"op":"i","ns":"users","_id":"1","o":{...}}.
+         * `op` is "i" (insert), "u" (update) or "d" (delete), `o` is the stored document.
+         * Collection wide operations have `op` "c" and `o` {"truncate":"<ns>"}, {"drop":"<ns>"}
+         * or {"import":"<ns>"}. After an import, the collection has to be read again as a whole:
+         * its documents aren't listed as changes.
+         * :param since: Last sequence number already consumed, 0 to read from the start.
+         * :param callback: The callback function called with each entry.
+         * :param limit: Maximum number of entries to read, 0 for no limit.
+         * :returns: The sequence number of the last entry read, `since` if there was none.
+         * */
+        template <typename T>
+        static uint32_t readChanges(uint32_t, T, uint32_t limit = 0);
+
+        /**
+         * truncateChanges(upTo)
+         * Discards acknowledged change entries with a sequence number up to `upTo`.
+         * The latest entry is always kept so that sequence numbers survive a restart.
+         * */
+        static bool truncateChanges(uint32_t);
+
 };
+
+
+// ------------------ TEMPLATE DEFINITIONS ------------------
+template <typename T>
+void ArduinoMongoDB::findDocuments(const String &collection, T callback)
+{
+    if(!connected())
+        return;
+    
+    // Check if the collection exists. Return if it does not.
+    if(!hasCollection(collection))
+        return;
+
+    // Rebuild the documents of a columnar collection row by row
+    if(isColumnar(collection)){
+        uint32_t rows = rowCount(collection);
+        for(uint32_t row = 0; row < rows; row++){
+            String doc = readRow(collection, String(row + 1));
+            if(doc.length() != 0)
+                callback(doc);
+        }
+        return;
+    }
+    
+    // Find all documents in the collection
+    Dir dir = little_fs.openDir(String(_currentURI) + collection);
+    while(dir.next()){
+        // Call the callback function with the document
+        callback(readDocument(collection, dir.fileName()));
+    }
+}
+
+template <typename T>
+void ArduinoMongoDB::findDocumentsParallel(const String &collection, T callback)
+{
+#if defined(ARDUINO_MONGODB_PARALLEL_SCAN)
+    if(!connected())
+        return;
+    
+    if(!hasCollection(collection))
+        return;
+
+    // The reader lists document files, columnar collections have none
+    if(isColumnar(collection)){
+        findDocuments(collection, callback);
+        return;
+    }
+
+    ScanContext ctx;
+    ctx.path = String(_currentURI) + collection;
+    auto codec = _codecs.find(collection);
+    if(codec != _codecs.end()){
+        ctx.codec = codec->second;
+        ctx.hasCodec = true;
+    }
+    ctx.items = xSemaphoreCreateCounting(ARDUINO_MONGODB_SCAN_QUEUE, 0);
+    ctx.space = xSemaphoreCreateCounting(ARDUINO_MONGODB_SCAN_QUEUE - 1, ARDUINO_MONGODB_SCAN_QUEUE - 1);
+    ctx.consumer = xTaskGetCurrentTaskHandle();
+
+    // Start the flash reader on the other core, scan on this task if it can't be created
+    TaskHandle_t reader = nullptr;
+    if(ctx.items == nullptr || ctx.space == nullptr ||
+       xTaskCreatePinnedToCore(scanReader, "amdb_scan", ARDUINO_MONGODB_SCAN_STACK, &ctx,
+                               uxTaskPriorityGet(nullptr), &reader, ARDUINO_MONGODB_SCAN_CORE) != pdPASS)
+    {
+        logwarn("Parallel scan unavailable: failed to start reader task");
+        if(ctx.items != nullptr)
+            vSemaphoreDelete(ctx.items);
+        if(ctx.space != nullptr)
+            vSemaphoreDelete(ctx.space);
+        findDocuments(collection, callback);
+        return;
+    }
+
+    // Parse documents as they arrive, blocking while the queue is empty.
+    // Being woken up without a document means the listing is done.
+    String doc;
+    while(xSemaphoreTake(ctx.items, portMAX_DELAY) == pdTRUE && ctx.queue.pop(doc)){
+        xSemaphoreGive(ctx.space);
+        callback(doc);
+    }
+
+    // Wait until the reader no longer uses `ctx`
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    vSemaphoreDelete(ctx.items);
+    vSemaphoreDelete(ctx.space);
+#else
+    findDocuments(collection, callback);
+#endif
+}
+
+template <typename T>
+uint32_t ArduinoMongoDB::scanColumn(const String &collection, const String &field, T callback)
+{
+    ColumnScan scan;
+    if(!openColumn(collection, field, scan))
+        return 0;
+
+    double values[ARDUINO_MONGODB_COLUMN_CHUNK];
+    uint8_t present[ARDUINO_MONGODB_COLUMN_CHUNK];
+
+    uint32_t count = 0;
+    uint32_t row = 0;
+    size_t rows;
+    while((rows = readColumnChunk(scan, values, present)) > 0){
+        for(size_t i = 0; i < rows; i++){
+            if(present[i]){
+                callback(row + i + 1, values[i]);
+                count++;
+            }
+        }
+        row += rows;
+    }
+    if(scan.failed)
+        logerr("Failed to scan column " + field + " of collection " + collection + ": only " + String(row) + " rows read");
+    return count;
+}
+
+template <typename T>
+size_t ArduinoMongoDB::deleteMany(const String &collection, T filter)
+{
+    if(!connected() || !hasCollection(collection))
+        return 0;
+
+    // Collect the matches first: the collection can't change while it's listed
+    std::vector<String> IDs;
+    if(isColumnar(collection)){
+        uint32_t rows = rowCount(collection);
+        for(uint32_t row = 0; row < rows; row++){
+            String doc = readRow(collection, String(row + 1));
+            if(doc.length() != 0 && filter(doc))
+                IDs.push_back(String(row + 1));
+        }
+    }
+    else{
+        Dir dir = little_fs.openDir(String(_currentURI) + collection);
+        while(dir.next()){
+            if(filter(readDocument(collection, dir.fileName())))
+                IDs.push_back(dir.fileName());
+        }
+    }
+    return removeDocuments(collection, IDs);
+}
+
+template <typename T>
+size_t ArduinoMongoDB::deleteMany(const String &collection, const String &field, T predicate)
+{
+    std::vector<String> IDs;
+    scanColumn(collection, field, [&](uint32_t ID, double value){
+        if(predicate(value))
+            IDs.push_back(String(ID));
+    });
+    return removeDocuments(collection, IDs);
+}
+
+template <typename T>
+uint32_t ArduinoMongoDB::readChanges(uint32_t since, T callback, uint32_t limit)
+{
+    if(!connected() || !_changeLogEnabled)
+        return since;
+
+    uint32_t seq = since + 1;
+    if(seq < _firstChange)
+    {
+        logwarn("Change log was truncated past sequence " + String(since) + ": changes were lost");
+        seq = _firstChange;
+    }
+
+    // Entries are addressed by sequence number, only the requested ones are read
+    uint32_t count = 0;
+    for(; seq <= _lastChange; seq++){
+        if(limit != 0 && count == limit)
+            break;
+
+        String entry = little_fs.readFile(changeFilename(seq));
+        if(entry.length() == 0)
+        {
+            logerr("Failed to read change " + String(seq));
+            break;
+        }
+
+        callback(entry);
+        since = seq;
+        count++;
+    }
+    return since;
+}
+
 #endif
 
 
@@ -19,48 +19,65 @@ bool ArduinoMongoSchema::verifyDocument(const String& doc) const
 
     // iterate over all fields in the schema
     for(auto field: _schema){
-        // If a field is required, confirm key exists in doc 
-        if(field.second.required){
-            bool exists = json.containsKey(field.first);
-            if(!exists)
-            {
-                logerr("Validation of field " + field.first + " failed: field is required");
-                return false;
-            }
-                
-        }
+        if(!verifyField(field.first, field.second, json))
+            return false;
+    }
 
-        // For all keys that exist in the document confirm they have the right type
-        // Fields that are not required can be missing from the document
-        if(json.containsKey(field.first)){
-            if(!checkDataConversion(json[field.first], field.second.type))
-            {
-                logerr("Validation of field " + field.first + " failed: wrong type");
-                return false;
-            }
+    return true;
+}
+
+bool ArduinoMongoSchema::verifyField(const String& key, JsonObject& json) const
+{
+    // Keys that are not in the schema are not validated
+    auto field = _schema.find(key);
+    if(field == _schema.end())
+        return true;
+    return verifyField(field->first, field->second, json);
+}
+
+bool ArduinoMongoSchema::verifyField(const String& name, const ArduinoMongoSchemaField& field, JsonObject& json) const
+{
+    // If a field is required, confirm key exists in doc 
+    if(field.required){
+        bool exists = json.containsKey(name);
+        if(!exists)
+        {
+            logerr("Validation of field " + name + " failed: field is required");
+            return false;
         }
+            
+    }
 
-        // If a field min/max !infinity() and is a numeric type, validate that the value is within the range
-        if(field.second.min != -infinity() || field.second.max != infinity()){
-            if(field.second.type == DBType::Int || field.second.type == DBType::Float || field.second.type == DBType::Double){
-                if(json[field.first].as<double>() < field.second.min || json[field.first].as<double>() > field.second.max)
-                {
-                    logerr("Validation of field " + field.first + " failed: Value is out of range.");
-                    return false;
-                }
-            }
+    // For all keys that exist in the document confirm they have the right type
+    // Fields that are not required can be missing from the document
+    if(json.containsKey(name)){
+        if(!hasType(json[name], field.type) && !checkDataConversion(json[name], field.type))
+        {
+            logerr("Validation of field " + name + " failed: wrong type");
+            return false;
         }
+    }
 
-        // If a field has a validation function, call it and confirm it returns true
-        if(field.second.validation != nullptr){
-            if(!field.second.validation(json[field.first]))
+    // If a field min/max !infinity() and is a numeric type, validate that the value is within the range
+    if(field.min != -infinity() || field.max != infinity()){
+        if(field.type == DBType::Int || field.type == DBType::Float || field.type == DBType::Double){
+            if(json[name].as<double>() < field.min || json[name].as<double>() > field.max)
             {
-                logerr("Validation of field " + field.first + " failed: Validation function returned false");
+                logerr("Validation of field " + name + " failed: Value is out of range.");
                 return false;
             }
         }
     }
 
+    // If a field has a validation function, call it and confirm it returns true
+    if(field.validation != nullptr){
+        if(!field.validation(json[name]))
+        {
+            logerr("Validation of field " + name + " failed: Validation function returned false");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -87,6 +104,50 @@ String ArduinoMongoSchema::fillDefaultValues(const String& doc) const
     return res;
 }
 
+std::vector<String> ArduinoMongoSchema::fieldNames() const
+{
+    std::vector<String> names;
+    for(auto field: _schema)
+        names.push_back(field.first);
+    return names;
+}
+
+DBType ArduinoMongoSchema::fieldType(const String& name) const
+{
+    auto field = _schema.find(name);
+    return field != _schema.end()? field->second.type : DBType::Str;
+}
+
+ArduinoMongoSchema& ArduinoMongoSchema::setColumnar(bool enabled)
+{
+    for(auto field: _schema){
+        if(enabled && (field.second.type == DBType::Str || field.second.type == DBType::Object))
+        {
+            logerr("Columnar storage unavailable: field " + field.first + " is not a scalar type");
+            return *this;
+        }
+    }
+    _columnar = enabled;
+    return *this;
+}
+
+// Returns true if a parsed JSON value already has the type, without converting it to a String
+bool ArduinoMongoSchema::hasType(const JsonVariant& value, DBType type)
+{
+    switch (type)
+    {
+    case DBType::Int:
+        return value.is<long>();
+    case DBType::Float:
+    case DBType::Double:
+        return value.is<double>() || value.is<long>();
+    case DBType::Boolean:
+        return value.is<bool>();
+    default:
+        return false;
+    }
+}
+
 String trimZeros(const String& str)
 {
     String res = str;
@@ -4,6 +4,7 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <map>
+#include <vector>
 #include "arduino_utilities.h"
 
 
@@ -65,12 +66,59 @@ struct ArduinoMongoSchema
     // Returns true if the document is valid according to the schema
     bool verifyDocument(const String&) const;
 
+    /* Returns true if field `key` of a parsed document is valid according to the schema.
+     * Keys that are not in the schema are always valid.
+     * */
+    bool verifyField(const String& key, JsonObject& json) const;
+
     /* Returns a document with default values for all missing fields */
     String fillDefaultValues(const String&) const;
 
+    /* Returns the names of all fields in the schema, in key order */
+    std::vector<String> fieldNames() const;
+
+    /* Returns the type of field `name`, Str if the schema has no such field */
+    DBType fieldType(const String& name) const;
+
+    // ------------------ COLLECTION OPTIONS ------------------
+    /* Stores documents of collections using this schema compressed.
+     * The field names are used as the compression dictionary, so they shouldn't change
+     * once documents are stored.
+     * */
+    ArduinoMongoSchema& setCompression(bool enabled = true) {_compression = enabled; return *this;}
+
+    // Returns true if documents using this schema are stored compressed
+    bool compression() const {return _compression;}
+
+    /* Deletes documents `seconds` after the time stored in their `field`.
+     * `field` holds a timestamp, in the same unit as the time passed to ArduinoMongoModel::expire.
+     * */
+    ArduinoMongoSchema& setExpiry(const String& field, uint32_t seconds) {_expiryField = field; _expireAfter = seconds; return *this;}
+
+    // Returns the timestamp field documents expire by
+    const String& expiryField() const {return _expiryField;}
+
+    // Returns the seconds documents are kept for, 0 if they don't expire
+    uint32_t expireAfter() const {return _expireAfter;}
+
+    /* Stores documents of collections using this schema as fixed width typed columns,
+     * one per field, so that a field can be scanned without reading whole documents.
+     * Only for schemas whose fields are all Int, Float, Double or Boolean.
+     * */
+    ArduinoMongoSchema& setColumnar(bool enabled = true);
+
+    // Returns true if documents using this schema are stored in columns
+    bool columnar() const {return _columnar;}
+
     private:
         const std::map<String, ArduinoMongoSchemaField> _schema;
+        bool _compression = false;
+        bool _columnar = false;
+        String _expiryField;
+        uint32_t _expireAfter = 0;
+        bool verifyField(const String& name, const ArduinoMongoSchemaField& field, JsonObject& json) const;
         bool checkDataConversion(const String& str, DBType type) const;
+        static bool hasType(const JsonVariant& value, DBType type);
         size_t _schemaBufferSize = 200;
         // TODO: See how DynamicJsonBuffer works with this
 };